@@ -13,6 +13,7 @@
 #include <linux/spinlock_types.h>
 #include <linux/semaphore.h>
 #include <linux/uidgid.h>
+#include <linux/device.h>
 
 #include "scull.h"
 
@@ -31,7 +32,7 @@ static int scull_s_open(struct inode *inode,struct file *filp)
         return -EBUSY;
     }
 
-    if((filp->f_flags & O_ACCMODE) == O_WRONLY)
+    if((filp->f_flags & O_ACCMODE) == O_WRONLY && !(filp->f_flags & O_APPEND))
         scull_trim(dev);
     filp->private_data = dev;
     return 0;
@@ -74,7 +75,7 @@ static int scull_u_open(struct inode *inode,struct file *filp)
     scull_u_count++;
     spin_unlock(&scull_u_lock);
 
-    if((filp->f_flags & O_ACCMODE) == O_WRONLY)
+    if((filp->f_flags & O_ACCMODE) == O_WRONLY && !(filp->f_flags & O_APPEND))
         scull_trim(dev);
     filp->private_data = dev;
     return 0;
@@ -126,7 +127,7 @@ static int scull_w_open(struct inode *inode,struct file *filp)
         scull_w_owner = current->cred->uid.val;
     scull_w_count++;
     spin_unlock(&scull_w_lock);
-    if((filp->f_flags & O_ACCMODE) == O_WRONLY)
+    if((filp->f_flags & O_ACCMODE) == O_WRONLY && !(filp->f_flags & O_APPEND))
         scull_trim(dev);
     filp->private_data = dev;
     return 0;
@@ -180,7 +181,8 @@ static struct scull_dev *scull_c_lookfor_device(dev_t key) {
     memset(lptr,0,sizeof(struct scull_listitem));
     lptr->key = key;
     scull_trim(&(lptr->device));
-    sema_init(&(lptr->device.sem),1);
+    lptr->device.max_bytes = scull_dev_max_bytes;
+    scull_dev_init(&(lptr->device));
 
     list_add(&lptr->list,&scull_c_list);
     return &(lptr->device);
@@ -203,7 +205,7 @@ static  int scull_c_open(struct inode *inode,struct file *filp)
     if(!dev)
         return -ENOMEM;
     
-    if((filp->f_flags & O_ACCMODE) == O_WRONLY)
+    if((filp->f_flags & O_ACCMODE) == O_WRONLY && !(filp->f_flags & O_APPEND))
         scull_trim(dev);
     filp->private_data = dev;
 
@@ -248,7 +250,8 @@ static void scull_access_setup(dev_t devno,struct scull_adev_info *devinfo)
 
     dev->quantum = scull_quantum;
     dev->qset = scull_qset;
-    sema_init(&(dev->sem),1);
+    dev->max_bytes = scull_dev_max_bytes;
+    scull_dev_init(dev);
 
     cdev_init(&dev->cdev,devinfo->fops);
     kobject_set_name(&dev->cdev.kobj,devinfo->name);
@@ -259,8 +262,11 @@ static void scull_access_setup(dev_t devno,struct scull_adev_info *devinfo)
     {
         printk(KERN_NOTICE "Error %d adding %s \n",err,devinfo->name);
         kobject_put(&dev->cdev.kobj);
-    } else
+    } else {
         printk(KERN_NOTICE "%s registered at %x\n",devinfo->name,devno);
+        if(IS_ERR(device_create(scull_class,NULL,devno,NULL,"%s",devinfo->name)))
+            printk(KERN_NOTICE "Error creating the node of %s\n",devinfo->name);
+    }
 }
 
 int scull_access_init(dev_t firstdev)
@@ -286,6 +292,7 @@ void scull_access_cleanup(void)
 
     for(i=0;i<SCULL_N_ADEVS;i++) {
         struct scull_dev *dev = scull_access_devs[i].sculldev;
+        device_destroy(scull_class,scull_a_firstdev+i);
         cdev_del(&dev->cdev);
         scull_trim(dev);
     }
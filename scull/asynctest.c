@@ -26,15 +26,15 @@ int main(int argc,char argv)
     sigaction(SIGIO,&action,NULL);
     
     fcntl(STDIN_FILENO,F_SETOWN,getpid());
-    fcntl(STDIN_FILENO,F_SETFL,fcntl(STDIN_FILENO,F_GETFL)|FASYNC);
+    /* SIGIO only comes when we ran dry, so drain until EAGAIN (or EOF) */
+    fcntl(STDIN_FILENO,F_SETFL,fcntl(STDIN_FILENO,F_GETFL)|FASYNC|O_NONBLOCK);
 
     while(1) {
         sleep(86400);
         if(!gotdata)
             continue;
-        count = read(0,buffer,4096);
-
-        write(1,buffer,count);
         gotdata = 0;
+        while((count = read(0,buffer,4096)) > 0)
+            write(1,buffer,count);
     }
 }
\ No newline at end of file
@@ -0,0 +1,224 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+static int bench_nfields;
+
+uint64_t bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint64_t bench_thread_cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int bench_lat_init(struct bench_lat *lat, size_t cap)
+{
+	lat->n = 0;
+	lat->cap = cap ? cap : 1;
+	lat->samples = malloc(lat->cap * sizeof(*lat->samples));
+	return lat->samples ? 0 : -ENOMEM;
+}
+
+void bench_lat_add(struct bench_lat *lat, uint64_t ns)
+{
+	if(lat->n == lat->cap) {
+		uint64_t *p = realloc(lat->samples, 2 * lat->cap * sizeof(*p));
+		if(!p)
+			return;
+		lat->samples = p;
+		lat->cap *= 2;
+	}
+	lat->samples[lat->n++] = ns;
+}
+
+void bench_lat_merge(struct bench_lat *dst, const struct bench_lat *src)
+{
+	size_t i;
+
+	for(i=0;i<src->n;i++)
+		bench_lat_add(dst, src->samples[i]);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+uint64_t bench_lat_pct(struct bench_lat *lat, double pct)
+{
+	size_t idx;
+
+	if(!lat->n)
+		return 0;
+	/* sorting is idempotent, so callers may ask for several percentiles */
+	qsort(lat->samples, lat->n, sizeof(*lat->samples), cmp_u64);
+	idx = (size_t)(pct / 100.0 * (lat->n - 1) + 0.5);
+	return lat->samples[idx];
+}
+
+void bench_lat_free(struct bench_lat *lat)
+{
+	free(lat->samples);
+	lat->samples = NULL;
+	lat->n = lat->cap = 0;
+}
+
+size_t bench_parse_size(const char *arg)
+{
+	char *end;
+	size_t v = strtoull(arg, &end, 0);
+
+	switch(*end) {
+	case 'k': case 'K': v <<= 10; break;
+	case 'm': case 'M': v <<= 20; break;
+	case 'g': case 'G': v <<= 30; break;
+	}
+	return v;
+}
+
+int bench_parse_sizes(const char *arg, size_t *sizes, int max)
+{
+	int n = 0;
+	const char *p = arg;
+
+	while(*p && n < max) {
+		sizes[n++] = bench_parse_size(p);
+		p = strchr(p, ',');
+		if(!p)
+			break;
+		p++;
+	}
+	return n;
+}
+
+void bench_begin(const char *name)
+{
+	bench_nfields = 0;
+	printf("{");
+	bench_kv_str("bench", name);
+}
+
+static void bench_sep(const char *key)
+{
+	printf("%s\"%s\":", bench_nfields++ ? "," : "", key);
+}
+
+void bench_kv_str(const char *key, const char *val)
+{
+	bench_sep(key);
+	printf("\"%s\"", val);
+}
+
+void bench_kv_u64(const char *key, uint64_t val)
+{
+	bench_sep(key);
+	printf("%llu", (unsigned long long)val);
+}
+
+void bench_kv_dbl(const char *key, double val)
+{
+	bench_sep(key);
+	printf("%.3f", val);
+}
+
+void bench_kv_lat(struct bench_lat *lat)
+{
+	bench_kv_u64("samples", lat->n);
+	bench_kv_u64("p50_ns", bench_lat_pct(lat, 50.0));
+	bench_kv_u64("p99_ns", bench_lat_pct(lat, 99.0));
+	bench_kv_u64("p999_ns", bench_lat_pct(lat, 99.9));
+	bench_kv_u64("max_ns", lat->n ? lat->samples[lat->n - 1] : 0);
+}
+
+void bench_end(void)
+{
+	printf("}\n");
+	fflush(stdout);
+}
+
+ssize_t bench_pwrite_all(int fd, const void *buf, size_t count, off_t off)
+{
+	size_t done = 0;
+
+	while(done < count) {
+		ssize_t n = pwrite(fd, (const char *)buf + done, count - done, off + done);
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		if(n == 0)
+			break;
+		done += n;
+	}
+	return done;
+}
+
+ssize_t bench_pread_all(int fd, void *buf, size_t count, off_t off)
+{
+	size_t done = 0;
+
+	while(done < count) {
+		ssize_t n = pread(fd, (char *)buf + done, count - done, off + done);
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		if(n == 0)
+			break;
+		done += n;
+	}
+	return done;
+}
+
+ssize_t bench_write_all(int fd, const void *buf, size_t count)
+{
+	size_t done = 0;
+
+	while(done < count) {
+		ssize_t n = write(fd, (const char *)buf + done, count - done);
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		done += n;
+	}
+	return done;
+}
+
+ssize_t bench_read_all(int fd, void *buf, size_t count)
+{
+	size_t done = 0;
+
+	while(done < count) {
+		ssize_t n = read(fd, (char *)buf + done, count - done);
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		if(n == 0)
+			break;
+		done += n;
+	}
+	return done;
+}
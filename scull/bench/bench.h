@@ -0,0 +1,51 @@
+#ifndef SCULL_BENCH_H
+#define SCULL_BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Helpers shared by the scull benchmarks.
+ *
+ * Every tool prints one JSON object per line on stdout, one line per
+ * measured configuration, so a run can be appended to a file and diffed
+ * against an older one.  Diagnostics go to stderr.
+ */
+
+struct bench_lat {
+	uint64_t *samples;
+	size_t n, cap;
+};
+
+uint64_t bench_now_ns(void);
+uint64_t bench_thread_cpu_ns(void);
+
+int bench_lat_init(struct bench_lat *lat, size_t cap);
+void bench_lat_add(struct bench_lat *lat, uint64_t ns);
+void bench_lat_merge(struct bench_lat *dst, const struct bench_lat *src);
+uint64_t bench_lat_pct(struct bench_lat *lat, double pct);
+void bench_lat_free(struct bench_lat *lat);
+
+/* Parse "512,4096,65536" (k/m suffixes allowed) into sizes[], returns count. */
+int bench_parse_sizes(const char *arg, size_t *sizes, int max);
+size_t bench_parse_size(const char *arg);
+
+/*
+ * Result lines: bench_begin() opens the object with the benchmark name,
+ * the bench_kv_*() calls append fields, bench_end() closes and flushes it.
+ */
+void bench_begin(const char *name);
+void bench_kv_str(const char *key, const char *val);
+void bench_kv_u64(const char *key, uint64_t val);
+void bench_kv_dbl(const char *key, double val);
+void bench_kv_lat(struct bench_lat *lat);
+void bench_end(void);
+
+/* Read/write the whole buffer, looping over the short counts scull returns. */
+ssize_t bench_pwrite_all(int fd, const void *buf, size_t count, off_t off);
+ssize_t bench_pread_all(int fd, void *buf, size_t count, off_t off);
+ssize_t bench_write_all(int fd, const void *buf, size_t count);
+ssize_t bench_read_all(int fd, void *buf, size_t count);
+
+#endif
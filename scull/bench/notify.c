@@ -0,0 +1,235 @@
+/*
+ * notify: compare blocking read, poll() and SIGIO consumers of a scullpipe.
+ *
+ * A producer thread writes timestamped messages at a fixed interval; the
+ * consumer picks them up using the selected wakeup mechanism and records
+ * the write-to-read latency of every message, together with the consumer
+ * CPU time and the number of wakeups (reads or signals) it took.
+ *
+ *   notify [-d /dev/scullpipe0] [-m block,poll,sigio] [-s 64] [-n 20000] [-i 50]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "bench.h"
+
+enum { M_BLOCK, M_POLL, M_SIGIO, NMODES };
+static const char *mode_names[NMODES] = { "block", "poll", "sigio" };
+
+static const char *devpath = "/dev/scullpipe0";
+
+struct producer {
+	pthread_t tid;
+	size_t size;
+	long count;
+	long interval_us;
+	int err;
+};
+
+struct consumer {
+	int mode;
+	size_t size;
+	long count;
+	struct bench_lat lat;
+	uint64_t wakeups, signals, cpu_ns;
+	int err;
+};
+
+static void *producer_fn(void *arg)
+{
+	struct producer *p = arg;
+	char *msg = calloc(1, p->size);
+	long i;
+	int fd;
+
+	fd = open(devpath, O_WRONLY);
+	if(fd < 0 || !msg) {
+		p->err = errno;
+		free(msg);
+		return NULL;
+	}
+	for(i=0;i<p->count;i++) {
+		uint64_t now = bench_now_ns();
+
+		memcpy(msg, &now, sizeof(now));
+		if(bench_write_all(fd, msg, p->size) != (ssize_t)p->size) {
+			p->err = errno;
+			break;
+		}
+		if(p->interval_us)
+			usleep(p->interval_us);
+	}
+	close(fd);
+	free(msg);
+	return NULL;
+}
+
+/* Account for every complete message in the stream; returns messages seen. */
+static long consume(struct consumer *c, char *acc, size_t *fill, const char *buf, size_t n)
+{
+	uint64_t now = bench_now_ns();
+	long seen = 0;
+
+	while(n) {
+		size_t take = c->size - *fill;
+
+		if(take > n)
+			take = n;
+		memcpy(acc + *fill, buf, take);
+		*fill += take;
+		buf += take;
+		n -= take;
+		if(*fill == c->size) {
+			uint64_t sent;
+
+			memcpy(&sent, acc, sizeof(sent));
+			bench_lat_add(&c->lat, now - sent);
+			*fill = 0;
+			seen++;
+		}
+	}
+	return seen;
+}
+
+static void run_consumer(struct consumer *c, int fd)
+{
+	size_t bufsize = 4096, fill = 0;
+	char *buf = malloc(bufsize), *acc = malloc(c->size);
+	uint64_t c0 = bench_thread_cpu_ns();
+	long got = 0;
+	sigset_t set;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGIO);
+
+	while(got < c->count) {
+		ssize_t n;
+
+		if(c->mode == M_POLL) {
+			struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+			if(poll(&pfd, 1, 1000) <= 0)
+				continue;
+		} else if(c->mode == M_SIGIO) {
+			struct timespec ts = { 1, 0 };
+
+			if(sigtimedwait(&set, NULL, &ts) < 0)
+				continue;
+			c->signals++;
+		}
+
+		/* drain: one wakeup may cover several messages */
+		for(;;) {
+			n = read(fd, buf, bufsize);
+			if(n <= 0)
+				break;
+			c->wakeups++;
+			got += consume(c, acc, &fill, buf, n);
+			if(c->mode == M_BLOCK || got >= c->count)
+				break;
+		}
+		if(n < 0 && errno != EAGAIN && errno != EINTR) {
+			c->err = errno;
+			break;
+		}
+	}
+	c->cpu_ns = bench_thread_cpu_ns() - c0;
+	free(buf);
+	free(acc);
+}
+
+static int run(int mode, size_t size, long count, long interval_us)
+{
+	struct producer p = { .size = size, .count = count, .interval_us = interval_us };
+	struct consumer c = { .mode = mode, .size = size, .count = count };
+	int fd, flags, err;
+	sigset_t set;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGIO);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	flags = (mode == M_BLOCK) ? O_RDONLY : O_RDONLY | O_NONBLOCK;
+	fd = open(devpath, flags);
+	if(fd < 0) {
+		perror("notify: open");
+		return -1;
+	}
+	if(mode == M_SIGIO) {
+		struct f_owner_ex owner = { .type = F_OWNER_TID, .pid = syscall(SYS_gettid) };
+
+		fcntl(fd, F_SETOWN_EX, &owner);
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_ASYNC);
+	}
+
+	bench_lat_init(&c.lat, count);
+	pthread_create(&p.tid, NULL, producer_fn, &p);
+	run_consumer(&c, fd);
+	pthread_join(p.tid, NULL);
+	close(fd);
+
+	err = c.err ? c.err : p.err;
+	bench_begin("notify");
+	bench_kv_str("dev", devpath);
+	bench_kv_str("mode", mode_names[mode]);
+	bench_kv_u64("size", size);
+	bench_kv_u64("interval_us", interval_us);
+	bench_kv_u64("messages", c.lat.n);
+	bench_kv_u64("wakeups", c.wakeups);
+	bench_kv_u64("signals", c.signals);
+	bench_kv_dbl("cpu_ns_per_msg", c.lat.n ? (double)c.cpu_ns / c.lat.n : 0);
+	bench_kv_lat(&c.lat);
+	bench_kv_u64("errno", err);
+	bench_end();
+
+	bench_lat_free(&c.lat);
+	return err ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	int modes[NMODES] = { 1, 1, 1 };
+	size_t size = 64;
+	long count = 20000, interval_us = 50;
+	int opt, m, ret = 0;
+
+	while((opt = getopt(argc, argv, "d:m:s:n:i:")) != -1) {
+		switch(opt) {
+		case 'd':
+			devpath = optarg;
+			break;
+		case 'm':
+			for(m=0;m<NMODES;m++)
+				modes[m] = strstr(optarg, mode_names[m]) != NULL;
+			break;
+		case 's':
+			size = bench_parse_size(optarg);
+			break;
+		case 'n':
+			count = atol(optarg);
+			break;
+		case 'i':
+			interval_us = atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-d dev] [-m modes] [-s size] [-n count] [-i interval_us]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(size < sizeof(uint64_t))
+		size = sizeof(uint64_t);
+
+	for(m=0;m<NMODES;m++)
+		if(modes[m] && run(m, size, count, interval_us) < 0)
+			ret = 1;
+	return ret;
+}
@@ -0,0 +1,122 @@
+/*
+ * openclose: open/close rate on the access-controlled scull devices.
+ *
+ * Several threads hammer open()+close() on one node for a fixed time.
+ * Failed opens are counted rather than treated as fatal, since EBUSY is
+ * the expected answer from scullsingle under contention.
+ *
+ *   openclose [-t 1,4] [-T 1] [/dev/scullsingle /dev/sculluid ...]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "bench.h"
+
+#define MAX_THREADS 16
+
+static const char *default_devs[] = {
+	"/dev/scull0", "/dev/scullsingle", "/dev/sculluid", "/dev/scullwuid", "/dev/scullpriv",
+};
+
+static volatile int stop;
+
+struct worker {
+	pthread_t tid;
+	const char *path;
+	uint64_t opens, fails;
+	int last_err;
+};
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+
+	while(!stop) {
+		/* read-only so the memory devices are not truncated each time */
+		int fd = open(w->path, O_RDONLY | O_NONBLOCK);
+
+		if(fd < 0) {
+			w->fails++;
+			w->last_err = errno;
+			continue;
+		}
+		close(fd);
+		w->opens++;
+	}
+	return NULL;
+}
+
+static void run(const char *path, int nthreads, double seconds)
+{
+	struct worker w[MAX_THREADS];
+	uint64_t opens = 0, fails = 0, t0, elapsed;
+	int i, last_err = 0;
+
+	memset(w, 0, sizeof(w));
+	stop = 0;
+	t0 = bench_now_ns();
+	for(i=0;i<nthreads;i++) {
+		w[i].path = path;
+		pthread_create(&w[i].tid, NULL, worker_fn, &w[i]);
+	}
+	usleep((useconds_t)(seconds * 1e6));
+	stop = 1;
+	for(i=0;i<nthreads;i++) {
+		pthread_join(w[i].tid, NULL);
+		opens += w[i].opens;
+		fails += w[i].fails;
+		if(w[i].last_err)
+			last_err = w[i].last_err;
+	}
+	elapsed = bench_now_ns() - t0;
+
+	bench_begin("openclose");
+	bench_kv_str("dev", path);
+	bench_kv_u64("threads", nthreads);
+	bench_kv_u64("opens", opens);
+	bench_kv_u64("fails", fails);
+	bench_kv_u64("elapsed_ns", elapsed);
+	bench_kv_dbl("opens_s", elapsed ? opens * 1e9 / elapsed : 0);
+	bench_kv_u64("errno", last_err);
+	bench_end();
+}
+
+int main(int argc, char **argv)
+{
+	size_t threads[MAX_THREADS] = { 1, 4 };
+	int nthreads = 2, opt, i, t;
+	double seconds = 1.0;
+
+	while((opt = getopt(argc, argv, "t:T:")) != -1) {
+		switch(opt) {
+		case 't':
+			nthreads = bench_parse_sizes(optarg, threads, MAX_THREADS);
+			break;
+		case 'T':
+			seconds = atof(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t threads] [-T seconds] [dev...]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	for(t=0;t<nthreads;t++) {
+		if(!threads[t] || threads[t] > MAX_THREADS)
+			continue;
+		if(optind < argc) {
+			for(i=optind;i<argc;i++)
+				run(argv[i], threads[t], seconds);
+		} else {
+			for(i=0;i<(int)(sizeof(default_devs)/sizeof(default_devs[0]));i++)
+				run(default_devs[i], threads[t], seconds);
+		}
+	}
+	return 0;
+}
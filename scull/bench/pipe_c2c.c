@@ -0,0 +1,306 @@
+/*
+ * pipe_c2c: cross-core traffic between the two sides of one scullpipe.
+ *
+ * Streams data through /dev/scullpipe0 with the producer and the
+ * consumer pinned to two different CPUs (-c, default 0,1), for each
+ * chunk size.  The two sides share no lock and each side's pointer
+ * keeps a cache line of its own, so at small sizes the rate is bounded
+ * by the lines that have to cross between the CPUs: the data and one
+ * pointer each way.  The HITM counts come from running it under perf
+ * c2c against the loaded module:
+ *
+ *   perf c2c record -a -- ./pipe_c2c && perf c2c report --stdio
+ *
+ * For comparison the same sizes then go through the ring algorithm of
+ * ring.c in user space between the same two CPUs, once with the fields
+ * split over cache lines the way struct scull_pipe lays them out
+ * ("split") and once with them all in one line ("packed").  -n skips
+ * the module run, so the layouts can be compared without it loaded.
+ *
+ *   pipe_c2c [-d /dev/scullpipe0] [-c 0,1] [-s 8,64,1024] [-b 16m] [-n]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "bench.h"
+
+#define MAX_SIZES 16
+#define LINE 64
+#define RING_SIZE 4000		/* scull_p_buffer's default */
+
+static const char *devpath = "/dev/scullpipe0";
+
+/*
+ * The pointers ring.c moves, in the two layouts.  "split" follows
+ * struct scull_pipe: the consumer's rp and its cached copy of wp share
+ * a line, the producer's wp and its copy of rp share the next one.
+ * buffer and end are read-mostly and live in struct ring below.
+ */
+struct ring_split {
+	char *rp;
+	char *wp_seen;
+	char *wp __attribute__((aligned(LINE)));
+	char *rp_seen;
+} __attribute__((aligned(LINE)));
+
+struct ring_packed {
+	char *rp, *wp_seen;
+	char *wp, *rp_seen;
+} __attribute__((aligned(LINE)));
+
+/* the same code runs over either layout through these */
+struct ring {
+	char *buffer, *end;
+	char **rp, **wp_seen;
+	char **wp, **rp_seen;
+};
+
+struct side {
+	pthread_t tid;
+	int cpu, write;
+	int fd;			/* module run */
+	struct ring *ring;	/* ring runs */
+	size_t size, total;
+	int err;
+};
+
+static void pin(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/* bytes between rp and wp, as scull_p_room() */
+static size_t ring_used(struct ring *r, char *rp, char *wp)
+{
+	return wp >= rp ? wp - rp : (r->end - r->buffer) - (rp - wp);
+}
+
+static size_t ring_read(struct ring *r, char *buf, size_t count)
+{
+	char *rp = *r->rp, *wp = *r->wp_seen;
+	size_t avail = ring_used(r, rp, wp), n;
+
+	if(avail < count) {
+		wp = *r->wp_seen = __atomic_load_n(r->wp, __ATOMIC_ACQUIRE);
+		avail = ring_used(r, rp, wp);
+		if(!avail)
+			return 0;
+	}
+	if(count > avail)
+		count = avail;
+	n = count < (size_t)(r->end - rp) ? count : (size_t)(r->end - rp);
+	memcpy(buf, rp, n);
+	memcpy(buf + n, r->buffer, count - n);
+	rp += count;
+	if(rp >= r->end)
+		rp -= r->end - r->buffer;
+	__atomic_store_n(r->rp, rp, __ATOMIC_RELEASE);
+	return count;
+}
+
+static size_t ring_write(struct ring *r, const char *buf, size_t count)
+{
+	char *wp = *r->wp, *rp = *r->rp_seen;
+	size_t room = (r->end - r->buffer) - 1 - ring_used(r, rp, wp), n;
+
+	if(room < count) {
+		rp = *r->rp_seen = __atomic_load_n(r->rp, __ATOMIC_ACQUIRE);
+		room = (r->end - r->buffer) - 1 - ring_used(r, rp, wp);
+		if(!room)
+			return 0;
+	}
+	if(count > room)
+		count = room;
+	n = count < (size_t)(r->end - wp) ? count : (size_t)(r->end - wp);
+	memcpy(wp, buf, n);
+	memcpy(r->buffer, buf + n, count - n);
+	wp += count;
+	if(wp >= r->end)
+		wp -= r->end - r->buffer;
+	__atomic_store_n(r->wp, wp, __ATOMIC_RELEASE);
+	return count;
+}
+
+static void *side_fn(void *arg)
+{
+	struct side *s = arg;
+	char *buf = malloc(s->size);
+	size_t done = 0;
+
+	if(!buf) {
+		s->err = ENOMEM;
+		return NULL;
+	}
+	pin(s->cpu);
+	memset(buf, 0x11, s->size);
+	while(done < s->total) {
+		size_t want = s->total - done < s->size ? s->total - done : s->size;
+		ssize_t n;
+
+		if(s->ring) {
+			n = s->write ? ring_write(s->ring, buf, want) : ring_read(s->ring, buf, want);
+			if(!n) {
+				sched_yield();
+				continue;
+			}
+		} else {
+			n = s->write ? write(s->fd, buf, want) : read(s->fd, buf, want);
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n <= 0) {
+				s->err = n < 0 ? errno : EIO;
+				break;
+			}
+		}
+		done += n;
+	}
+	free(buf);
+	return NULL;
+}
+
+static void report(const char *target, const int *cpus, size_t size, size_t total,
+		   uint64_t ns, int err)
+{
+	bench_begin("pipe_c2c");
+	bench_kv_str("target", target);
+	bench_kv_u64("cpu_w", cpus[0]);
+	bench_kv_u64("cpu_r", cpus[1]);
+	bench_kv_u64("size", size);
+	bench_kv_dbl("mb_s", err || !ns ? 0 : total * 1000.0 / ns);
+	bench_kv_dbl("ns_per_op", err || !ns ? 0 : (double)ns / ((total + size - 1) / size));
+	bench_kv_u64("errno", err);
+	bench_end();
+}
+
+static int run_sides(struct side *sides)
+{
+	int i, err = 0;
+
+	for(i=0;i<2;i++)
+		pthread_create(&sides[i].tid, NULL, side_fn, &sides[i]);
+	for(i=0;i<2;i++) {
+		pthread_join(sides[i].tid, NULL);
+		if(sides[i].err)
+			err = sides[i].err;
+	}
+	return err;
+}
+
+static void run_module(const int *cpus, size_t size, size_t total)
+{
+	struct side sides[2];
+	uint64_t t0, ns = 0;
+	int i, err = 0;
+
+	/* both ends open before either starts, so the ring stays allocated */
+	for(i=0;i<2;i++) {
+		sides[i] = (struct side){ .write = i == 0, .cpu = cpus[i], .size = size, .total = total };
+		sides[i].fd = open(devpath, sides[i].write ? O_WRONLY : O_RDONLY);
+		if(sides[i].fd < 0) {
+			fprintf(stderr, "%s: %s\n", devpath, strerror(errno));
+			err = errno;
+			break;
+		}
+	}
+	if(!err) {
+		t0 = bench_now_ns();
+		err = run_sides(sides);
+		ns = bench_now_ns() - t0;
+	}
+	report(devpath, cpus, size, total, ns, err);
+	while(i-- > 0)
+		close(sides[i].fd);
+}
+
+static void run_ring(const char *layout, const int *cpus, size_t size, size_t total)
+{
+	struct ring_split *split = NULL;
+	struct ring_packed *packed = NULL;
+	char *buffer = NULL;
+	struct ring r;
+	struct side sides[2];
+	uint64_t t0, ns = 0;
+	int i, err = 0;
+
+	if(!strcmp(layout, "split") && !posix_memalign((void **)&split, LINE, sizeof(*split))) {
+		r = (struct ring){ .rp = &split->rp, .wp_seen = &split->wp_seen,
+				   .wp = &split->wp, .rp_seen = &split->rp_seen };
+	} else if(!strcmp(layout, "packed") && !posix_memalign((void **)&packed, LINE, sizeof(*packed))) {
+		r = (struct ring){ .rp = &packed->rp, .wp_seen = &packed->wp_seen,
+				   .wp = &packed->wp, .rp_seen = &packed->rp_seen };
+	} else {
+		err = ENOMEM;
+	}
+	if(!err && !posix_memalign((void **)&buffer, LINE, RING_SIZE)) {
+		r.buffer = buffer;
+		r.end = buffer + RING_SIZE;
+		*r.rp = *r.wp = *r.rp_seen = *r.wp_seen = buffer;
+		for(i=0;i<2;i++)
+			sides[i] = (struct side){ .write = i == 0, .cpu = cpus[i], .ring = &r,
+						  .size = size, .total = total };
+		t0 = bench_now_ns();
+		err = run_sides(sides);
+		ns = bench_now_ns() - t0;
+	} else if(!err) {
+		err = ENOMEM;
+	}
+	report(layout, cpus, size, total, ns, err);
+	free(split);
+	free(packed);
+	free(buffer);
+}
+
+int main(int argc, char **argv)
+{
+	size_t sizes[MAX_SIZES] = { 8, 64, 1024 }, cpu_arg[2], total = 16 << 20;
+	int nsizes = 3, cpus[2] = { 0, 1 }, module = 1, opt, i;
+
+	while((opt = getopt(argc, argv, "d:c:s:b:n")) != -1) {
+		switch(opt) {
+		case 'd':
+			devpath = optarg;
+			break;
+		case 'c':
+			if(bench_parse_sizes(optarg, cpu_arg, 2) != 2) {
+				fprintf(stderr, "-c takes two CPUs\n");
+				return 2;
+			}
+			cpus[0] = cpu_arg[0];
+			cpus[1] = cpu_arg[1];
+			break;
+		case 's':
+			nsizes = bench_parse_sizes(optarg, sizes, MAX_SIZES);
+			break;
+		case 'b':
+			total = bench_parse_size(optarg);
+			break;
+		case 'n':
+			module = 0;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-d dev] [-c cpu,cpu] [-s sizes] [-b bytes] [-n]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	for(i=0;i<nsizes;i++) {
+		if(!sizes[i])
+			continue;
+		if(module)
+			run_module(cpus, sizes[i], total);
+		run_ring("split", cpus, sizes[i], total);
+		run_ring("packed", cpus, sizes[i], total);
+	}
+	return 0;
+}
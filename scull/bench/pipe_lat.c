@@ -0,0 +1,151 @@
+/*
+ * pipe_lat: ping-pong round trip latency between two scullpipe devices.
+ *
+ * The main thread writes a message to the ping pipe and waits for it to
+ * come back on the pong pipe; an echo thread moves it across.  Each
+ * sample is one full round trip.
+ *
+ *   pipe_lat [-p /dev/scullpipe0] [-q /dev/scullpipe1] [-s 1,64,1024] [-n 100000] [-w 1000]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "bench.h"
+
+#define MAX_SIZES 16
+
+static const char *ping_path = "/dev/scullpipe0";
+static const char *pong_path = "/dev/scullpipe1";
+
+struct echo {
+	pthread_t tid;
+	int in, out;
+	size_t size;
+	long iters;
+	int err;
+};
+
+static void *echo_fn(void *arg)
+{
+	struct echo *e = arg;
+	char *buf = malloc(e->size);
+	long i;
+
+	if(!buf) {
+		e->err = ENOMEM;
+		return NULL;
+	}
+	for(i=0;i<e->iters;i++) {
+		if(bench_read_all(e->in, buf, e->size) != (ssize_t)e->size ||
+		   bench_write_all(e->out, buf, e->size) != (ssize_t)e->size) {
+			e->err = errno ? errno : EIO;
+			break;
+		}
+	}
+	free(buf);
+	return NULL;
+}
+
+static int run(size_t size, long iters, long warmup)
+{
+	struct echo e;
+	struct bench_lat lat;
+	char *buf;
+	int ping_w, ping_r, pong_w, pong_r;
+	long i;
+	int err = 0;
+
+	/* separate descriptors per direction, like a real producer/consumer pair */
+	ping_w = open(ping_path, O_WRONLY);
+	ping_r = open(ping_path, O_RDONLY);
+	pong_w = open(pong_path, O_WRONLY);
+	pong_r = open(pong_path, O_RDONLY);
+	buf = malloc(size);
+	if(ping_w < 0 || ping_r < 0 || pong_w < 0 || pong_r < 0 || !buf) {
+		perror("pipe_lat: open");
+		return -1;
+	}
+	memset(buf, 0x42, size);
+
+	e.in = ping_r;
+	e.out = pong_w;
+	e.size = size;
+	e.iters = iters + warmup;
+	e.err = 0;
+	pthread_create(&e.tid, NULL, echo_fn, &e);
+
+	bench_lat_init(&lat, iters);
+	for(i=0;i<iters + warmup;i++) {
+		uint64_t t0 = bench_now_ns();
+
+		if(bench_write_all(ping_w, buf, size) != (ssize_t)size ||
+		   bench_read_all(pong_r, buf, size) != (ssize_t)size) {
+			err = errno ? errno : EIO;
+			break;
+		}
+		if(i >= warmup)
+			bench_lat_add(&lat, bench_now_ns() - t0);
+	}
+	if(err)
+		pthread_cancel(e.tid);
+	pthread_join(e.tid, NULL);
+	if(!err)
+		err = e.err;
+
+	bench_begin("pipe_pingpong");
+	bench_kv_str("ping", ping_path);
+	bench_kv_str("pong", pong_path);
+	bench_kv_u64("size", size);
+	bench_kv_lat(&lat);
+	bench_kv_u64("errno", err);
+	bench_end();
+
+	bench_lat_free(&lat);
+	free(buf);
+	close(ping_w);
+	close(ping_r);
+	close(pong_w);
+	close(pong_r);
+	return err ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	size_t sizes[MAX_SIZES] = { 1, 64, 1024 };
+	int nsizes = 3, opt, s, ret = 0;
+	long iters = 100000, warmup = 1000;
+
+	while((opt = getopt(argc, argv, "p:q:s:n:w:")) != -1) {
+		switch(opt) {
+		case 'p':
+			ping_path = optarg;
+			break;
+		case 'q':
+			pong_path = optarg;
+			break;
+		case 's':
+			nsizes = bench_parse_sizes(optarg, sizes, MAX_SIZES);
+			break;
+		case 'n':
+			iters = atol(optarg);
+			break;
+		case 'w':
+			warmup = atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-p ping] [-q pong] [-s sizes] [-n iters] [-w warmup]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	for(s=0;s<nsizes;s++)
+		if(sizes[s] && run(sizes[s], iters, warmup) < 0)
+			ret = 1;
+	return ret;
+}
@@ -0,0 +1,206 @@
+/*
+ * pipe_tput: streaming throughput through one scullpipe with N producers
+ * and M consumers.
+ *
+ * Producers write fixed-size chunks for the configured duration;
+ * consumers drain with poll() so they notice the end of the run.  The
+ * reported rate is what the consumers actually received.
+ *
+ *   pipe_tput [-d /dev/scullpipe0] [-s 64,1024,4000] [-p 1,2] [-c 1,2] [-T 2]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "bench.h"
+
+#define MAX_SIZES 16
+
+static const char *devpath = "/dev/scullpipe0";
+static volatile int stop_producers, stop_consumers;
+
+struct worker {
+	pthread_t tid;
+	size_t size;
+	uint64_t bytes;
+	uint64_t cpu_ns;
+	int err;
+};
+
+static void *producer_fn(void *arg)
+{
+	struct worker *w = arg;
+	char *buf = malloc(w->size);
+	uint64_t c0 = bench_thread_cpu_ns();
+	int fd;
+
+	fd = open(devpath, O_WRONLY | O_NONBLOCK);
+	if(fd < 0 || !buf) {
+		w->err = errno;
+		free(buf);
+		return NULL;
+	}
+	memset(buf, 0x33, w->size);
+
+	while(!stop_producers) {
+		struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+		ssize_t n = write(fd, buf, w->size);
+
+		if(n > 0) {
+			w->bytes += n;
+			continue;
+		}
+		if(n < 0 && errno != EAGAIN && errno != EINTR) {
+			w->err = errno;
+			break;
+		}
+		poll(&pfd, 1, 10);
+	}
+	w->cpu_ns = bench_thread_cpu_ns() - c0;
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+static void *consumer_fn(void *arg)
+{
+	struct worker *w = arg;
+	char *buf = malloc(w->size);
+	uint64_t c0 = bench_thread_cpu_ns();
+	int fd;
+
+	fd = open(devpath, O_RDONLY | O_NONBLOCK);
+	if(fd < 0 || !buf) {
+		w->err = errno;
+		free(buf);
+		return NULL;
+	}
+
+	for(;;) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		ssize_t n = read(fd, buf, w->size);
+
+		if(n > 0) {
+			w->bytes += n;
+			continue;
+		}
+		if(n < 0 && errno != EAGAIN && errno != EINTR) {
+			w->err = errno;
+			break;
+		}
+		if(stop_consumers)
+			break;
+		poll(&pfd, 1, 10);
+	}
+	w->cpu_ns = bench_thread_cpu_ns() - c0;
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+static int run(size_t size, int nprod, int ncons, double seconds)
+{
+	struct worker *p = calloc(nprod, sizeof(*p)), *c = calloc(ncons, sizeof(*c));
+	uint64_t in = 0, out = 0, cpu = 0, t0, elapsed;
+	int i, err = 0;
+
+	if(!p || !c) {
+		free(p);
+		free(c);
+		return -1;
+	}
+
+	stop_producers = stop_consumers = 0;
+	for(i=0;i<ncons;i++) {
+		c[i].size = size;
+		pthread_create(&c[i].tid, NULL, consumer_fn, &c[i]);
+	}
+	t0 = bench_now_ns();
+	for(i=0;i<nprod;i++) {
+		p[i].size = size;
+		pthread_create(&p[i].tid, NULL, producer_fn, &p[i]);
+	}
+
+	usleep((useconds_t)(seconds * 1e6));
+	stop_producers = 1;
+	for(i=0;i<nprod;i++) {
+		pthread_join(p[i].tid, NULL);
+		in += p[i].bytes;
+		cpu += p[i].cpu_ns;
+		if(p[i].err)
+			err = p[i].err;
+	}
+	/* let the consumers drain what is still buffered in the pipe */
+	usleep(50000);
+	elapsed = bench_now_ns() - t0;
+	stop_consumers = 1;
+	for(i=0;i<ncons;i++) {
+		pthread_join(c[i].tid, NULL);
+		out += c[i].bytes;
+		cpu += c[i].cpu_ns;
+		if(c[i].err)
+			err = c[i].err;
+	}
+
+	bench_begin("pipe_stream");
+	bench_kv_str("dev", devpath);
+	bench_kv_u64("size", size);
+	bench_kv_u64("producers", nprod);
+	bench_kv_u64("consumers", ncons);
+	bench_kv_u64("bytes_in", in);
+	bench_kv_u64("bytes_out", out);
+	bench_kv_u64("elapsed_ns", elapsed);
+	bench_kv_dbl("mb_s", elapsed ? out * 1000.0 / elapsed : 0);
+	bench_kv_dbl("cpu_ns_per_byte", out ? (double)cpu / out : 0);
+	bench_kv_u64("errno", err);
+	bench_end();
+
+	free(p);
+	free(c);
+	return err ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	size_t sizes[MAX_SIZES] = { 64, 1024, 4000 };
+	size_t prods[MAX_SIZES] = { 1, 2, 4 }, conss[MAX_SIZES] = { 1, 2, 4 };
+	int nsizes = 3, nprods = 3, nconss = 3, opt, s, i, j, ret = 0;
+	double seconds = 2.0;
+
+	while((opt = getopt(argc, argv, "d:s:p:c:T:")) != -1) {
+		switch(opt) {
+		case 'd':
+			devpath = optarg;
+			break;
+		case 's':
+			nsizes = bench_parse_sizes(optarg, sizes, MAX_SIZES);
+			break;
+		case 'p':
+			nprods = bench_parse_sizes(optarg, prods, MAX_SIZES);
+			break;
+		case 'c':
+			nconss = bench_parse_sizes(optarg, conss, MAX_SIZES);
+			break;
+		case 'T':
+			seconds = atof(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-d dev] [-s sizes] [-p producers] [-c consumers] [-T seconds]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	for(s=0;s<nsizes;s++)
+		for(i=0;i<nprods;i++)
+			for(j=0;j<nconss;j++)
+				if(sizes[s] && prods[i] && conss[j] &&
+				   run(sizes[s], prods[i], conss[j], seconds) < 0)
+					ret = 1;
+	return ret;
+}
@@ -0,0 +1,15 @@
+#!/bin/sh
+# Run every scull benchmark with its default matrix.  Each result is one
+# JSON object per line on stdout; a "run" line with the kernel version and
+# time stamp goes first so several runs can share one results file.
+dir=$(dirname "$0")
+
+echo "{\"bench\":\"run\",\"kernel\":\"$(uname -r)\",\"time\":\"$(date -u +%Y-%m-%dT%H:%M:%SZ)\",\"cpus\":$(nproc)}"
+
+$dir/seqrand "$@"
+$dir/pipe_lat
+$dir/pipe_tput
+$dir/pipe_c2c
+$dir/openclose
+$dir/notify
+$dir/snapshot
@@ -0,0 +1,231 @@
+/*
+ * seqrand: sequential and random read/write throughput on /dev/scullN.
+ *
+ * Each thread opens the device on its own descriptor and works on a
+ * private slice of the device, so the numbers reflect contention on the
+ * device semaphore rather than on shared offsets.  The device is
+ * truncated (opened O_WRONLY) before every write pass.
+ *
+ *   seqrand [-d /dev/scull0] [-s 512,4000,64k] [-t 1,4] [-b 16m] [-m seqw,seqr,randw,randr]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "bench.h"
+
+#define MAX_SIZES 16
+
+enum { SEQW, SEQR, RANDW, RANDR, NMODES };
+static const char *mode_names[NMODES] = { "seqw", "seqr", "randw", "randr" };
+
+static const char *devpath = "/dev/scull0";
+static size_t total = 16 << 20;
+
+struct worker {
+	pthread_t tid;
+	int mode;
+	size_t size;
+	off_t base;
+	size_t slice;
+	unsigned int seed;
+	uint64_t bytes;
+	struct bench_lat lat;
+	int err;
+};
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	int write_mode = (w->mode == SEQW || w->mode == RANDW);
+	size_t nops = w->slice / w->size, i;
+	char *buf;
+	int fd;
+
+	if(!nops)
+		return NULL;
+	buf = malloc(w->size);
+	if(!buf) {
+		w->err = ENOMEM;
+		return NULL;
+	}
+	memset(buf, 0x5a, w->size);
+
+	fd = open(devpath, O_RDWR);
+	if(fd < 0) {
+		w->err = errno;
+		free(buf);
+		return NULL;
+	}
+
+	for(i=0;i<nops;i++) {
+		off_t off = w->base;
+		uint64_t t0;
+		ssize_t n;
+
+		if(w->mode == RANDW || w->mode == RANDR)
+			off += (off_t)(rand_r(&w->seed) % nops) * w->size;
+		else
+			off += (off_t)i * w->size;
+
+		t0 = bench_now_ns();
+		if(write_mode)
+			n = bench_pwrite_all(fd, buf, w->size, off);
+		else
+			n = bench_pread_all(fd, buf, w->size, off);
+		bench_lat_add(&w->lat, bench_now_ns() - t0);
+
+		if(n < 0) {
+			w->err = errno;
+			break;
+		}
+		w->bytes += n;
+	}
+
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+static int truncate_dev(void)
+{
+	int fd = open(devpath, O_WRONLY);
+
+	if(fd < 0)
+		return -1;
+	close(fd);
+	return 0;
+}
+
+/* Fill the whole range sequentially so read passes find data everywhere. */
+static int populate(size_t size)
+{
+	char *buf = malloc(size);
+	size_t off;
+	int fd, ret = 0;
+
+	if(!buf)
+		return -1;
+	memset(buf, 0xa5, size);
+	fd = open(devpath, O_WRONLY);
+	if(fd < 0) {
+		free(buf);
+		return -1;
+	}
+	for(off = 0; off + size <= total; off += size)
+		if(bench_pwrite_all(fd, buf, size, off) < 0) {
+			ret = -1;
+			break;
+		}
+	close(fd);
+	free(buf);
+	return ret;
+}
+
+static int run(int mode, size_t size, int nthreads)
+{
+	struct worker *w = calloc(nthreads, sizeof(*w));
+	struct bench_lat all;
+	uint64_t bytes = 0, t0, elapsed;
+	int i, err = 0;
+
+	if(!w)
+		return -1;
+
+	if(mode == SEQW || mode == RANDW) {
+		if(truncate_dev() < 0) {
+			free(w);
+			return -1;
+		}
+	} else if(populate(size) < 0) {
+		free(w);
+		return -1;
+	}
+
+	bench_lat_init(&all, total / size);
+	t0 = bench_now_ns();
+	for(i=0;i<nthreads;i++) {
+		w[i].mode = mode;
+		w[i].size = size;
+		w[i].slice = total / nthreads;
+		w[i].base = (off_t)i * w[i].slice;
+		w[i].seed = 1234 + i;
+		bench_lat_init(&w[i].lat, w[i].slice / size);
+		pthread_create(&w[i].tid, NULL, worker_fn, &w[i]);
+	}
+	for(i=0;i<nthreads;i++) {
+		pthread_join(w[i].tid, NULL);
+		bytes += w[i].bytes;
+		if(w[i].err)
+			err = w[i].err;
+		bench_lat_merge(&all, &w[i].lat);
+		bench_lat_free(&w[i].lat);
+	}
+	elapsed = bench_now_ns() - t0;
+
+	if(err)
+		fprintf(stderr, "seqrand: %s %s size %zu: %s\n",
+			devpath, mode_names[mode], size, strerror(err));
+
+	bench_begin(mode_names[mode]);
+	bench_kv_str("dev", devpath);
+	bench_kv_u64("size", size);
+	bench_kv_u64("threads", nthreads);
+	bench_kv_u64("bytes", bytes);
+	bench_kv_u64("elapsed_ns", elapsed);
+	bench_kv_dbl("mb_s", elapsed ? bytes * 1000.0 / elapsed : 0);
+	bench_kv_dbl("ops_s", elapsed ? all.n * 1e9 / elapsed : 0);
+	bench_kv_lat(&all);
+	bench_kv_u64("errno", err);
+	bench_end();
+
+	bench_lat_free(&all);
+	free(w);
+	return err ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	size_t sizes[MAX_SIZES] = { 512, 4000, 4096, 65536 }, threads[MAX_SIZES] = { 1, 4 };
+	int nsizes = 4, nthreads = 2, modes[NMODES] = { 1, 1, 1, 1 };
+	int opt, m, s, t, ret = 0;
+
+	while((opt = getopt(argc, argv, "d:s:t:b:m:")) != -1) {
+		switch(opt) {
+		case 'd':
+			devpath = optarg;
+			break;
+		case 's':
+			nsizes = bench_parse_sizes(optarg, sizes, MAX_SIZES);
+			break;
+		case 't':
+			nthreads = bench_parse_sizes(optarg, threads, MAX_SIZES);
+			break;
+		case 'b':
+			total = bench_parse_size(optarg);
+			break;
+		case 'm':
+			for(m=0;m<NMODES;m++)
+				modes[m] = strstr(optarg, mode_names[m]) != NULL;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-d dev] [-s sizes] [-t threads] [-b bytes] [-m modes]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	for(m=0;m<NMODES;m++) {
+		if(!modes[m])
+			continue;
+		for(s=0;s<nsizes;s++)
+			for(t=0;t<nthreads;t++)
+				if(sizes[s] && threads[t] && run(m, sizes[s], threads[t]) < 0)
+					ret = 1;
+	}
+	return ret;
+}
@@ -0,0 +1,202 @@
+/*
+ * snapshot: cost of a consistent copy of /dev/scullN to concurrent writers.
+ *
+ * A writer thread keeps overwriting random 4000-byte quanta of the device
+ * and records how long each pwrite takes.  Meanwhile the main thread
+ * copies the device out in one of two ways:
+ *
+ *   dump      read the device end to end through its own descriptor
+ *   snapshot  SCULL_IOCSNAPSHOT, then read the snapshot end to end
+ *
+ * Only the snapshot copy is consistent; the dump shows what reading the
+ * device costs the writer.  Each mode reports the copy time, the ioctl
+ * latency and the writer's latency percentiles.
+ *
+ *   snapshot [-d /dev/scull0] [-b 64m] [-n 8] [-m dump,snapshot]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+
+#include "bench.h"
+#include "scull_ioctl.h"
+
+#define QUANTUM 4000
+
+#define min_size(a, b) ((a) < (b) ? (a) : (b))
+
+enum { DUMP, SNAPSHOT, NMODES };
+static const char *mode_names[NMODES] = { "dump", "snapshot" };
+
+static const char *devpath = "/dev/scull0";
+static size_t total = 64 << 20;
+static volatile int stop;
+
+struct writer {
+	pthread_t tid;
+	int fd;
+	unsigned int seed;
+	struct bench_lat lat;
+};
+
+static void *writer_fn(void *arg)
+{
+	struct writer *w = arg;
+	size_t nq = total / QUANTUM;
+	char buf[QUANTUM];
+
+	memset(buf, 0xa5, sizeof(buf));
+	while(!stop) {
+		off_t off = (off_t)(rand_r(&w->seed) % nq) * QUANTUM;
+		uint64_t t0 = bench_now_ns();
+
+		if(bench_pwrite_all(w->fd, buf, sizeof(buf), off) < 0)
+			break;
+		bench_lat_add(&w->lat, bench_now_ns() - t0);
+	}
+	return NULL;
+}
+
+/* Read fd from offset 0 to the end; returns the bytes read or -1. */
+static ssize_t copy_out(int fd, char *buf, size_t len)
+{
+	size_t done = 0;
+
+	for(;;) {
+		ssize_t n = pread(fd, buf, len, done);
+
+		if(n < 0)
+			return -1;
+		if(n == 0)
+			break;
+		done += n;
+	}
+	return done;
+}
+
+static int run(int mode, int rounds)
+{
+	struct writer w = { .seed = 1 };
+	struct bench_lat ioc;
+	size_t len = 1 << 20;
+	char *buf = malloc(len);
+	uint64_t t0, copy_ns = 0, bytes = 0;
+	size_t off;
+	int fd, r, err = 0;
+
+	/* fill the device so both copies have the same amount to move */
+	w.fd = open(devpath, O_WRONLY | O_TRUNC);
+	if(w.fd < 0 || !buf) {
+		fprintf(stderr, "snapshot: %s: %s\n", devpath, strerror(errno));
+		free(buf);
+		return 1;
+	}
+	memset(buf, 0x3c, len);
+	for(off=0;off<total;off+=len)
+		bench_pwrite_all(w.fd, buf, min_size(len, total - off), off);
+	close(w.fd);
+
+	w.fd = open(devpath, O_RDWR);
+	fd = open(devpath, O_RDONLY);
+	if(w.fd < 0 || fd < 0) {
+		fprintf(stderr, "snapshot: %s: %s\n", devpath, strerror(errno));
+		free(buf);
+		return 1;
+	}
+	bench_lat_init(&w.lat, 1 << 16);
+	bench_lat_init(&ioc, rounds);
+	stop = 0;
+	pthread_create(&w.tid, NULL, writer_fn, &w);
+
+	for(r=0;r<rounds;r++) {
+		int src = fd;
+		ssize_t n;
+
+		t0 = bench_now_ns();
+		if(mode == SNAPSHOT) {
+			src = ioctl(fd, SCULL_IOCSNAPSHOT);
+			if(src < 0) {
+				fprintf(stderr, "snapshot: SCULL_IOCSNAPSHOT: %s\n", strerror(errno));
+				err = 1;
+				break;
+			}
+			bench_lat_add(&ioc, bench_now_ns() - t0);
+		}
+		n = copy_out(src, buf, len);
+		if(src != fd)
+			close(src);
+		if(n < 0) {
+			err = 1;
+			break;
+		}
+		copy_ns += bench_now_ns() - t0;
+		bytes += n;
+	}
+
+	stop = 1;
+	pthread_join(w.tid, NULL);
+	close(w.fd);
+	close(fd);
+
+	if(!err) {
+		bench_begin("snapshot");
+		bench_kv_str("dev", devpath);
+		bench_kv_str("mode", mode_names[mode]);
+		bench_kv_u64("bytes", bytes);
+		bench_kv_u64("rounds", r);
+		bench_kv_dbl("copy_ms", copy_ns / 1e6 / (r ? r : 1));
+		if(mode == SNAPSHOT) {
+			bench_kv_u64("ioctl_p50_ns", bench_lat_pct(&ioc, 50));
+			bench_kv_u64("ioctl_p99_ns", bench_lat_pct(&ioc, 99));
+		}
+		bench_kv_u64("writes", w.lat.n);
+		bench_kv_lat(&w.lat);
+		bench_end();
+	}
+	bench_lat_free(&w.lat);
+	bench_lat_free(&ioc);
+	free(buf);
+	return err;
+}
+
+int main(int argc, char **argv)
+{
+	int modes[NMODES] = { 1, 1 };
+	int rounds = 8, opt, m, err = 0;
+
+	while((opt = getopt(argc, argv, "d:b:n:m:")) != -1) {
+		switch(opt) {
+		case 'd':
+			devpath = optarg;
+			break;
+		case 'b':
+			total = bench_parse_size(optarg);
+			break;
+		case 'n':
+			rounds = atoi(optarg);
+			break;
+		case 'm':
+			for(m=0;m<NMODES;m++)
+				modes[m] = strstr(optarg, mode_names[m]) != NULL;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-d dev] [-b bytes] [-n rounds] [-m dump,snapshot]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(total < QUANTUM || rounds < 1) {
+		fprintf(stderr, "snapshot: need at least one quantum and one round\n");
+		return 2;
+	}
+
+	for(m=0;m<NMODES;m++)
+		if(modes[m])
+			err |= run(m, rounds);
+	return err;
+}
@@ -0,0 +1,282 @@
+/*
+ * Transparent compression of cold quanta for the scull memory devices.
+ *
+ * When scull_compress is set, a delayed work item walks every device
+ * every scull_compress_age/2 seconds and compresses the quanta that have
+ * not been read or written for scull_compress_age seconds, using the
+ * crypto compression API (lz4 by default).  scull_read/scull_write inflate
+ * a compressed quantum again on first access through scull_z_inflate().
+ *
+ * Quanta that do not shrink by at least an eighth are left alone.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/cdev.h>
+#include <linux/mutex.h>
+#include <linux/semaphore.h>
+#include <linux/wait.h>
+#include <linux/jiffies.h>
+#include <linux/workqueue.h>
+#include <linux/crypto.h>
+#include <linux/percpu.h>
+#include <linux/topology.h>
+#include <linux/hash.h>
+
+#include "scull.h"
+
+static bool scull_compress = false;
+module_param(scull_compress, bool, 0444);
+MODULE_PARM_DESC(scull_compress, "Compress quanta that have not been used for scull_compress_age seconds");
+
+static unsigned int scull_compress_age = 30;
+module_param(scull_compress_age, uint, 0644);
+MODULE_PARM_DESC(scull_compress_age, "Seconds without access before a quantum is compressed");
+
+static char *scull_compress_alg = "lz4";
+module_param(scull_compress_alg, charp, 0444);
+MODULE_PARM_DESC(scull_compress_alg, "Crypto API compression algorithm (lz4, zstd, ...)");
+
+/*
+ * A transform and a scratch buffer per CPU, as zswap keeps them, so that
+ * quanta are inflated on all CPUs at once.  The mutex only matters when
+ * a task moves to another CPU after picking the context of this one.
+ */
+struct scull_z_ctx {
+	struct mutex lock;
+	struct crypto_comp *tfm;
+	void *scratch;
+};
+static struct scull_z_ctx __percpu *scull_z_ctx;
+static unsigned int scull_z_scratch_len;
+
+/*
+ * Readers of several devices (a snapshot and its device, say) may find
+ * the same compressed quantum; one of them inflates it, under the lock
+ * the quantum hashes to.
+ */
+#define SCULL_Z_LOCK_BITS 6
+static struct mutex scull_z_locks[1 << SCULL_Z_LOCK_BITS];
+
+static void scull_z_scan(struct work_struct *work);
+static DECLARE_DELAYED_WORK(scull_z_work, scull_z_scan);
+
+static unsigned long scull_z_period(void)
+{
+	return max(1U, scull_compress_age / 2) * HZ;
+}
+
+int scull_z_inflate(struct scull_dev *dev,struct scull_qbuf *qb)
+{
+	struct mutex *lock = &scull_z_locks[hash_ptr(qb, SCULL_Z_LOCK_BITS)];
+	struct scull_z_ctx *ctx;
+	unsigned int dlen = dev->quantum;
+	void *raw;
+	int err = 0;
+
+	raw = scull_qdata_alloc(qb->nid);
+	if(!raw)
+		return -ENOMEM;
+
+	mutex_lock(lock);
+	if(!qb->clen) {
+		/* somebody else got here first */
+		mutex_unlock(lock);
+		scull_qdata_free(raw);
+		return 0;
+	}
+	ctx = raw_cpu_ptr(scull_z_ctx);
+	mutex_lock(&ctx->lock);
+	err = crypto_comp_decompress(ctx->tfm, qb->data, qb->clen, raw, &dlen);
+	mutex_unlock(&ctx->lock);
+	if(!err && dlen != dev->quantum)
+		err = -EIO;
+	if(err) {
+		mutex_unlock(lock);
+		scull_qdata_free(raw);
+		printk(KERN_ALERT "scull: failed to inflate quantum, error %d\n", err);
+		return err;
+	}
+	kfree(qb->data);
+	qb->data = raw;
+	/* pairs with the acquire in scull_qbuf_get() of a lockless reader */
+	smp_store_release(&qb->clen, 0);
+	mutex_unlock(lock);
+	return 0;
+}
+
+/*
+ * Compress qb in place.  Caller holds dev->sem exclusive and the only
+ * reference on qb, so nobody reads it meanwhile.  Returns -E2BIG if it
+ * does not shrink by an eighth.
+ */
+int scull_z_deflate(struct scull_dev *dev,struct scull_qbuf *qb)
+{
+	struct scull_z_ctx *ctx = raw_cpu_ptr(scull_z_ctx);
+	unsigned int dlen = scull_z_scratch_len;
+	void *packed;
+	int err;
+
+	mutex_lock(&ctx->lock);
+	err = crypto_comp_compress(ctx->tfm, qb->data, dev->quantum, ctx->scratch, &dlen);
+	if(err || dlen > dev->quantum - dev->quantum / 8) {
+		/* incompressible: look at it again after another full age */
+		qb->atime = jiffies;
+		err = -E2BIG;
+		goto out;
+	}
+	packed = kmalloc_node(dlen, GFP_KERNEL_ACCOUNT, qb->nid);
+	if(!packed) {
+		err = -ENOMEM;
+		goto out;
+	}
+	memcpy(packed, ctx->scratch, dlen);
+	scull_qdata_free(qb->data);
+	qb->data = packed;
+	qb->clen = dlen;
+out:
+	mutex_unlock(&ctx->lock);
+	return err;
+}
+
+/* quanta compressed per hold of dev->sem */
+#define SCULL_Z_BATCH 64
+
+/*
+ * Compress the cold quanta of dev, SCULL_Z_BATCH at a time.  dev->sem is
+ * dropped between batches, so readers and writers wait for one batch at
+ * most; the walk then starts over from the head of the chain, which may
+ * have changed in the meantime, and skips to where the last batch ended.
+ */
+static void scull_z_scan_dev(struct scull_dev *dev)
+{
+	unsigned long cold = jiffies - (unsigned long)scull_compress_age * HZ;
+	struct scull_qset *dptr;
+	long start = 0, idx;
+	int i, batch;
+
+	do {
+		/* never make a writer wait for the scan; catch the device next time */
+		if(!down_write_trylock(&dev->sem))
+			return;
+		batch = 0;
+		idx = 0;
+		/* qsets shared with a snapshot are read-only, and so is all after them */
+		for(dptr = dev->data;dptr && atomic_read(&dptr->ref) == 1;dptr = dptr->next, idx += dev->qset) {
+			if(!dptr->data || idx + dev->qset <= start)
+				continue;
+			for(i = max(start - idx, 0L);i<dev->qset && batch < SCULL_Z_BATCH;i++) {
+				struct scull_qbuf *qb = dptr->data[i];
+
+				if(!qb || qb->clen || scull_qbuf_zero(qb) || !time_before(qb->atime, cold))
+					continue;
+				/* only private quanta are rewritten behind the readers' backs */
+				if(scull_dd_own(qb)) {
+					scull_z_deflate(dev,qb);
+					batch++;
+				}
+			}
+			if(batch == SCULL_Z_BATCH) {
+				start = idx + i;
+				break;
+			}
+		}
+		up_write(&dev->sem);
+		cond_resched();
+	} while(batch == SCULL_Z_BATCH);
+}
+
+static void scull_z_scan(struct work_struct *work)
+{
+	int i;
+
+	for(i=0;i<scull_nr_devs;i++) {
+		struct scull_dev *dev = scull_device(i);
+
+		if(dev)
+			scull_z_scan_dev(dev);
+	}
+	schedule_delayed_work(&scull_z_work, scull_z_period());
+}
+
+bool scull_z_ready(void)
+{
+	return scull_z_ctx != NULL;
+}
+
+/* Allocate the contexts of all CPUs; scull_z_init() and the tests do. */
+int scull_z_setup(void)
+{
+	struct scull_z_ctx *ctx;
+	int cpu, i, err;
+
+	scull_z_ctx = alloc_percpu(struct scull_z_ctx);
+	if(!scull_z_ctx)
+		return -ENOMEM;
+	for(i=0;i<ARRAY_SIZE(scull_z_locks);i++)
+		mutex_init(&scull_z_locks[i]);
+	/* generous enough for the worst-case expansion of lz4 and zstd */
+	scull_z_scratch_len = 2 * scull_quantum + 64;
+	for_each_possible_cpu(cpu) {
+		ctx = per_cpu_ptr(scull_z_ctx, cpu);
+		mutex_init(&ctx->lock);
+		ctx->tfm = crypto_alloc_comp(scull_compress_alg, 0, 0);
+		if(IS_ERR(ctx->tfm)) {
+			err = PTR_ERR(ctx->tfm);
+			ctx->tfm = NULL;
+			printk(KERN_ALERT "scull: compression algorithm %s unavailable, error %d\n",
+			       scull_compress_alg, err);
+			goto fail;
+		}
+		ctx->scratch = kmalloc_node(scull_z_scratch_len, GFP_KERNEL, cpu_to_node(cpu));
+		if(!ctx->scratch) {
+			err = -ENOMEM;
+			goto fail;
+		}
+	}
+	return 0;
+
+fail:
+	scull_z_teardown();
+	return err;
+}
+
+void scull_z_teardown(void)
+{
+	struct scull_z_ctx *ctx;
+	int cpu;
+
+	if(!scull_z_ctx)
+		return;
+	for_each_possible_cpu(cpu) {
+		ctx = per_cpu_ptr(scull_z_ctx, cpu);
+		if(ctx->tfm)
+			crypto_free_comp(ctx->tfm);
+		kfree(ctx->scratch);
+	}
+	free_percpu(scull_z_ctx);
+	scull_z_ctx = NULL;
+}
+
+int scull_z_init(void)
+{
+	int err;
+
+	if(!scull_compress)
+		return 0;
+	err = scull_z_setup();
+	if(err)
+		return err;
+	schedule_delayed_work(&scull_z_work, scull_z_period());
+	return 0;
+}
+
+void scull_z_exit(void)
+{
+	if(!scull_compress || !scull_z_ready())
+		return;
+	cancel_delayed_work_sync(&scull_z_work);
+	scull_z_teardown();
+}
@@ -0,0 +1,109 @@
+/*
+ * Content-based sharing of full quanta between and within scull devices.
+ *
+ * With scull_dedup set, every quantum written in full is hashed and
+ * looked up in a global table.  If an identical quantum already exists
+ * the new one is dropped and the slot takes a reference on the existing
+ * one instead; otherwise the new quantum is entered in the table.
+ * Shared quanta are never modified in place: scull_write copies them
+ * (see scull_qbuf_writable() in qset.c).
+ *
+ * A quantum leaves the table before it is modified in place (which only
+ * happens while nobody else holds a reference), compressed or freed,
+ * and lookups only take references with atomic_inc_not_zero(), so a
+ * quantum on its way out is never handed out again.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/cdev.h>
+#include <linux/semaphore.h>
+#include <linux/spinlock.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
+#include <linux/seq_file.h>
+
+#include "scull.h"
+
+bool scull_dedup = false;
+module_param(scull_dedup, bool, 0644);
+MODULE_PARM_DESC(scull_dedup, "Share identical full quanta between slots, copying on write");
+
+#define SCULL_DD_BITS 12
+
+static DEFINE_HASHTABLE(scull_dd_table, SCULL_DD_BITS);
+static DEFINE_SPINLOCK(scull_dd_lock);
+static unsigned long scull_dd_entries, scull_dd_hits;
+
+struct scull_qbuf *scull_dd_share(struct scull_dev *dev,struct scull_qbuf *qb)
+{
+	struct scull_qbuf *cur;
+	u32 hash;
+
+	if(!scull_dedup)
+		return qb;
+
+	hash = jhash(qb->data, dev->quantum, dev->quantum);
+	spin_lock(&scull_dd_lock);
+	hash_for_each_possible(scull_dd_table, cur, hnode, hash) {
+		if(cur->hash != hash || cur->clen || scull_qbuf_zero(cur))
+			continue;
+		if(memcmp(cur->data, qb->data, dev->quantum))
+			continue;
+		if(!atomic_inc_not_zero(&cur->ref))
+			continue;
+		scull_dd_hits++;
+		spin_unlock(&scull_dd_lock);
+		scull_qbuf_put(qb);
+		return cur;
+	}
+	qb->hash = hash;
+	hash_add(scull_dd_table, &qb->hnode, hash);
+	scull_dd_entries++;
+	spin_unlock(&scull_dd_lock);
+	return qb;
+}
+
+void scull_dd_forget(struct scull_qbuf *qb)
+{
+	if(hlist_unhashed(&qb->hnode))
+		return;
+	spin_lock(&scull_dd_lock);
+	if(!hlist_unhashed(&qb->hnode)) {
+		hash_del(&qb->hnode);
+		scull_dd_entries--;
+	}
+	spin_unlock(&scull_dd_lock);
+}
+
+/*
+ * True if the caller holds the only reference on qb, which is then out
+ * of the table: the check and the removal are one step under the lock,
+ * so no lookup can take a reference in between.  A shared quantum stays
+ * in the table.
+ */
+bool scull_dd_own(struct scull_qbuf *qb)
+{
+	bool own;
+
+	if(hlist_unhashed(&qb->hnode))
+		return atomic_read(&qb->ref) == 1;
+	spin_lock(&scull_dd_lock);
+	own = atomic_read(&qb->ref) == 1;
+	if(own && !hlist_unhashed(&qb->hnode)) {
+		hash_del(&qb->hnode);
+		scull_dd_entries--;
+	}
+	spin_unlock(&scull_dd_lock);
+	return own;
+}
+
+void scull_dd_show(struct seq_file *m)
+{
+	spin_lock(&scull_dd_lock);
+	seq_printf(m,"dedup: %s entries %lu hits %lu\n",
+		   scull_dedup ? "on" : "off", scull_dd_entries, scull_dd_hits);
+	spin_unlock(&scull_dd_lock);
+}
@@ -0,0 +1,30 @@
+/*
+ * Memory limits for the scull memory devices.
+ *
+ * scull_max_bytes caps the memory held by the quanta of all devices
+ * together, scull_dev_max_bytes is the initial per-device cap (which
+ * SCULL_IOCSLIMIT changes for one device).  Both count whole quanta and
+ * default to 0, no limit; writes and reservations past a limit fail with
+ * ENOSPC.  The accounting itself lives in qset.c.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/semaphore.h>
+#include <linux/seq_file.h>
+
+#include "scull.h"
+
+module_param(scull_max_bytes, ulong, 0644);
+MODULE_PARM_DESC(scull_max_bytes, "Limit on the memory of all scull devices together, in bytes (0: none)");
+
+module_param(scull_dev_max_bytes, ulong, 0444);
+MODULE_PARM_DESC(scull_dev_max_bytes, "Initial limit on the memory of each device, in bytes (0: none)");
+
+void scull_limit_show(struct seq_file *m)
+{
+	seq_printf(m,"memory: bytes %lu max %lu\n",
+		   scull_charged(), scull_max_bytes);
+}
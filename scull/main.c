@@ -8,190 +8,275 @@
 #include <linux/slab.h>
 #include <linux/cdev.h>
 #include <linux/semaphore.h>
+#include <linux/seq_file.h>
+#include <linux/capability.h>
+#include <linux/nodemask.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/mutex.h>
+#include <linux/version.h>
 
 #include "scull.h"
 
-int scull_quantum = 4000;
-int scull_qset = 1000;
 int scull_nr_devs = 4;
+module_param(scull_nr_devs, int, 0444);
+MODULE_PARM_DESC(scull_nr_devs, "Number of scull memory devices");
 
 static int scull_major = 0;
 static int scull_minor = 0;
 
-struct scull_dev *scull_devices;
+struct scull_dev **scull_devices;
+static DEFINE_MUTEX(scull_devices_lock);
+static struct kmem_cache *scull_dev_cache;
+static struct cdev scull_cdev;
+
+struct class *scull_class;
 
 int scull_open(struct inode *inode,struct file *filp);
 int scull_release(struct inode *inode, struct file *filp);
+long scull_ioctl(struct file *filp,unsigned int cmd,unsigned long arg);
+static unsigned int scull_poll(struct file *filp,poll_table *wait);
+static int scull_fasync(int fd,struct file *filp,int mode);
 
 struct file_operations scull_fops = {
 	.owner = THIS_MODULE,
-	//.llseek = scull_llseek,
+	.llseek = scull_llseek,
 	.read = scull_read,
 	.write = scull_write,
-	//.ioctl = scull_ioctl,
+	.unlocked_ioctl = scull_ioctl,
 	.open = scull_open,
 	.release = scull_release,
+	.poll = scull_poll,
+	.fasync = scull_fasync,
 };
 
-int scull_trim(struct scull_dev *dev) {
-	struct scull_qset *next, *dptr;
-	int qset = dev->qset;
-	int i;
-
-	for(dptr = dev->data;dptr;dptr=next) {
-		if(dptr->data) {
-			for(i=0;i<qset;i++)
-				kfree(dptr->data[i]);
-			kfree(dptr->data);
-			dptr->data = NULL;
-		}
-		next = dptr->next;
-		kfree(dptr);
-	}
-
-	dev->size = 0;
+/*
+ * A memory device is allocated, on its home node, when it is first
+ * opened: an idle device costs one pointer.  Once there it stays until
+ * the module is unloaded.
+ */
+static struct scull_dev *scull_dev_get(int index) {
+	struct scull_dev *dev = scull_device(index);
+	int nid;
+
+	if(dev)
+		return dev;
+	mutex_lock(&scull_devices_lock);
+	dev = scull_devices[index];
+	if(dev)
+		goto out;
+	nid = scull_numa_home(index);
+	dev = kmem_cache_alloc_node(scull_dev_cache,GFP_KERNEL | __GFP_ZERO,nid);
+	if(!dev)
+		goto out;
 	dev->quantum = scull_quantum;
 	dev->qset = scull_qset;
-	dev->data = NULL;
-	return 0;
-} 
+	dev->max_bytes = scull_dev_max_bytes;
+	scull_numa_setup(dev,nid);
+	scull_dev_init(dev);
+	smp_store_release(&scull_devices[index],dev);
+out:
+	mutex_unlock(&scull_devices_lock);
+	return dev;
+}
 
 int scull_open(struct inode *inode,struct file *filp) {
 	struct scull_dev *dev;
-	dev = container_of(inode->i_cdev,struct scull_dev,cdev);
+	dev = scull_dev_get(iminor(inode) - scull_minor);
+	if(!dev)
+		return -ENOMEM;
 	filp->private_data = dev;
 
-	if((filp->f_flags & O_ACCMODE) == O_WRONLY) {
+	/* appenders write to the end, so opening to append keeps the data */
+	if((filp->f_flags & O_ACCMODE) == O_WRONLY && !(filp->f_flags & O_APPEND)) {
+		if(down_write_killable(&dev->sem))
+			return -ERESTARTSYS;
 		scull_trim(dev);
+		up_write(&dev->sem);
 	}
 
 	return 0;
 }
 
 int scull_release(struct inode *inode, struct file *filp) {
+	scull_fasync(-1,filp,0);
 	return 0;
 }
 
-static struct scull_qset *scull_follow(struct scull_dev *dev,int n) {
-	struct scull_qset *qs = dev->data;
-
-	if(!qs) {
-		qs = dev->data = kmalloc(sizeof(struct scull_qset), GFP_KERNEL);
-		if(qs == NULL) return NULL;
-		memset(qs,0,sizeof(struct scull_qset));
-	}
+/*
+ * A memory device can always be written.  It is readable while the file
+ * position is short of the end; scull_write wakes pollers when it grows.
+ * A look at the size needs no lock, as a change of it is followed by a
+ * wakeup; the acquire pairs with the commit of an appender.
+ */
+static unsigned int scull_poll(struct file *filp,poll_table *wait) {
+	struct scull_dev *dev = filp->private_data;
+	unsigned int mask = POLLOUT | POLLWRNORM;
 
-	while(n--) {
-		if(!qs->next) {
-			qs->next = kmalloc(sizeof(struct scull_qset), GFP_KERNEL);
-			if(qs->next == NULL) return NULL;
-			memset(qs->next,0,sizeof(struct scull_qset));
-		}
-		qs = qs->next;
-		continue;
-	}
-	return qs;
+	poll_wait(filp,&dev->inq,wait);
+	if(filp->f_pos < smp_load_acquire(&dev->size))
+		mask |= POLLIN | POLLRDNORM;
+	return mask;
 }
 
-ssize_t scull_read(struct file *filp, char __user *buf,size_t count, loff_t *f_pos) {
+static int scull_fasync(int fd,struct file *filp,int mode) {
 	struct scull_dev *dev = filp->private_data;
-	struct scull_qset *dptr;
-	int quantum = dev->quantum, qset = dev->qset;
-	int itemsize = quantum * qset;
-	int item, s_pos, q_pos, rest;
-	ssize_t retval = 0;
-
-	if(down_interruptible(&dev->sem)) return -ERESTARTSYS;
-	if(*f_pos >= dev->size) goto out;
-	if(*f_pos + count > dev->size) count = dev->size - *f_pos;
-
-	item = (long)*f_pos/itemsize;
-	rest = (long)*f_pos%itemsize;
-	s_pos = rest / quantum; q_pos = rest%quantum;
 
-	dptr = scull_follow(dev,item);
-
-	if(dptr == NULL || !dptr->data || !dptr->data[s_pos]) goto out;
-
-	if(count > quantum - q_pos) count = quantum - q_pos;
+	return fasync_helper(fd,filp,mode,&dev->async_queue);
+}
 
-	if(copy_to_user(buf,dptr->data[s_pos] + q_pos,count)) {
-		retval = -EFAULT;
-		goto out;
+loff_t scull_llseek(struct file *filp,loff_t off,int whence) {
+	struct scull_dev *dev = filp->private_data;
+	loff_t newpos;
+
+	switch(whence) {
+	case SEEK_SET:
+		newpos = off;
+		break;
+	case SEEK_CUR:
+		newpos = filp->f_pos + off;
+		break;
+	case SEEK_END:
+		newpos = dev->size + off;
+		break;
+	default:
+		return -EINVAL;
 	}
-	
-	*f_pos += count;
-	retval = count;
-
-out:
-	up(&dev->sem);
-	return retval;
+	if(newpos < 0) return -EINVAL;
+	filp->f_pos = newpos;
+	return newpos;
 }
 
-ssize_t scull_write(struct file *filp,const char __user *buf,size_t count,loff_t *f_pos) {
+long scull_ioctl(struct file *filp,unsigned int cmd,unsigned long arg) {
 	struct scull_dev *dev = filp->private_data;
-	struct scull_qset *dptr;
-	int quantum = dev->quantum, qset = dev->qset;
-	int itemsize = quantum * qset;
-	int item,s_pos,q_pos,rest;
-	ssize_t retval = -ENOMEM;
-
-	if(down_interruptible(&dev->sem)) return -ERESTARTSYS;
-
-	item = (long)*f_pos / itemsize;
-	rest = (long)*f_pos % itemsize;
-	s_pos = rest / quantum; q_pos = rest % quantum;
-
-	dptr = scull_follow(dev,item);
-
-	if(dptr == NULL) goto out;
-	if(!dptr->data) {
-		dptr->data = kmalloc(qset * sizeof(char *),GFP_KERNEL);
-		if(!dptr->data) goto out;
-		memset(dptr->data,0,qset*sizeof(char *));
-	}
-	if(!dptr->data[s_pos]) {
-		dptr->data[s_pos] = kmalloc(quantum,GFP_KERNEL);
-		if(!dptr->data[s_pos]) goto out;
+	struct scull_numa numa;
+	struct scull_range range;
+	struct scull_limit limit;
+
+	if(_IOC_TYPE(cmd) != SCULL_IOC_MAGIC || _IOC_NR(cmd) > SCULL_IOC_MAXNR)
+		return -ENOTTY;
+
+	switch(cmd) {
+	case SCULL_IOCSNAPSHOT:
+		/* a snapshot is readable, so only hand one to readers */
+		if(!(filp->f_mode & FMODE_READ))
+			return -EBADF;
+		return scull_snapshot(dev);
+	case SCULL_IOCSNUMA:
+		if(!capable(CAP_SYS_ADMIN))
+			return -EPERM;
+		if(copy_from_user(&numa,(void __user *)arg,sizeof(numa)))
+			return -EFAULT;
+		return scull_numa_set(dev,&numa);
+	case SCULL_IOCGNUMA:
+		scull_numa_get(dev,&numa);
+		if(copy_to_user((void __user *)arg,&numa,sizeof(numa)))
+			return -EFAULT;
+		return 0;
+	case SCULL_IOCRESERVE:
+		if(!(filp->f_mode & FMODE_WRITE))
+			return -EBADF;
+		if(copy_from_user(&range,(void __user *)arg,sizeof(range)))
+			return -EFAULT;
+		if(range.off > LLONG_MAX || range.len > LLONG_MAX)
+			return -EINVAL;
+		return scull_reserve(dev,range.off,range.len);
+	case SCULL_IOCSLIMIT:
+		if(!capable(CAP_SYS_ADMIN))
+			return -EPERM;
+		if(copy_from_user(&limit,(void __user *)arg,sizeof(limit)))
+			return -EFAULT;
+		/* a limit below the current usage only stops further growth */
+		if(down_write_killable(&dev->sem))
+			return -ERESTARTSYS;
+		dev->max_bytes = limit.max_bytes;
+		up_write(&dev->sem);
+		return 0;
+	case SCULL_IOCGLIMIT:
+		if(down_read_killable(&dev->sem))
+			return -ERESTARTSYS;
+		limit.max_bytes = dev->max_bytes;
+		/* appenders may be adding quanta */
+		limit.bytes = READ_ONCE(dev->bytes);
+		up_read(&dev->sem);
+		if(copy_to_user((void __user *)arg,&limit,sizeof(limit)))
+			return -EFAULT;
+		return 0;
+	default:
+		return -ENOTTY;
 	}
+}
 
-	if(count > quantum - q_pos) count = quantum - q_pos;
-
-	if(copy_from_user(dptr->data[s_pos] + q_pos,buf,count)) {
-		retval = -EFAULT;
-		goto out;
+/*
+ * /proc/scullmem: one line per memory device.  ratio is the raw size of
+ * the device's quanta over the bytes actually kept for them, so it
+ * reflects compression, zero quanta and sharing alike.  The nodeN fields
+ * count the quanta with memory on each online node.
+ */
+static int scull_proc_show(struct seq_file *m, void *v) {
+	struct scull_stats st;
+	unsigned long raw, ratio, *nodes;
+	int i, nid;
+
+	nodes = kcalloc(nr_node_ids,sizeof(*nodes),GFP_KERNEL);
+	if(!nodes)
+		return -ENOMEM;
+	for(i=0;i<scull_nr_devs;i++) {
+		struct scull_dev *dev = scull_device(i);
+
+		if(!dev)
+			continue;
+		memset(nodes,0,nr_node_ids * sizeof(*nodes));
+		if(down_read_killable(&dev->sem)) {
+			kfree(nodes);
+			return -ERESTARTSYS;
+		}
+		scull_stats(dev,&st,nodes);
+		raw = st.quanta * dev->quantum;
+		up_read(&dev->sem);
+
+		ratio = st.stored ? raw * 100 / st.stored : 100;
+		seq_printf(m,"scull%d: size %lu qsets %lu snapped %lu quanta %lu compressed %lu zero %lu shared %lu stored %lu ratio %lu.%02lu bytes %lu max %lu numa %s home %d",
+			   i,st.size,st.qsets,st.snapped,st.quanta,st.compressed,st.zero,st.shared,st.stored,ratio / 100,ratio % 100,
+			   READ_ONCE(dev->bytes),dev->max_bytes,scull_numa_name(dev->numa_policy),dev->numa_node);
+		for_each_online_node(nid)
+			seq_printf(m," node%d %lu",nid,nodes[nid]);
+		seq_putc(m,'\n');
 	}
-
-	*f_pos += count;
-	retval = count;
-
-	if(dev->size < *f_pos) dev->size = *f_pos;
-
-out:
-	up(&dev->sem);
-	return retval;
+	kfree(nodes);
+	scull_dd_show(m);
+	scull_limit_show(m);
+	return 0;
 }
 
-static void scull_setup_dev(struct scull_dev *dev, int index) {
-	int err, devno = MKDEV(scull_major,scull_minor+index);
+/* one cdev covers all memory devices; scull_open tells them apart */
+static int scull_setup_cdev(void) {
+	int err, i;
+	dev_t devno = MKDEV(scull_major,scull_minor);
 
-	cdev_init(&dev->cdev,&scull_fops);
-	dev->cdev.owner = THIS_MODULE;
-	dev->cdev.ops = &scull_fops;
-	err = cdev_add(&dev->cdev,devno,1);
-	if(err)
-		printk(KERN_ALERT"Error %d adding scull%d",err,index);
+	cdev_init(&scull_cdev,&scull_fops);
+	scull_cdev.owner = THIS_MODULE;
+	err = cdev_add(&scull_cdev,devno,scull_nr_devs);
+	if(err) {
+		printk(KERN_ALERT"Error %d adding scull devices",err);
+		return err;
+	}
+	for(i=0;i<scull_nr_devs;i++)
+		if(IS_ERR(device_create(scull_class,NULL,devno+i,NULL,"scull%d",i)))
+			printk(KERN_ALERT"Error creating the node of scull%d",i);
+	return 0;
 }
 
 static int __init scull_init(void) 
 {
 	int err = -1;
 	dev_t dev = 0;
-	int i;	
 	
 	printk(KERN_ALERT"Initializing scull device.\n");
 
-	err = alloc_chrdev_region(&dev,0,4,"scull");
+	if(scull_nr_devs <= 0)
+		return -EINVAL;
+	err = alloc_chrdev_region(&dev,0,scull_nr_devs,"scull");
 
 	if(err < 0)
 	{
@@ -202,28 +287,50 @@ static int __init scull_init(void)
 	scull_major = MAJOR(dev);
 	scull_minor = MINOR(dev);
 
+	err = scull_numa_init();
+	if(err)
+		goto free_chrdev;
+	err = scull_qset_init();
+	if(err)
+		goto free_chrdev;
 
-	scull_devices = kmalloc(scull_nr_devs*sizeof(struct scull_dev),GFP_KERNEL);
-	if(!scull_devices)
+	scull_dev_cache = kmem_cache_create("scull_dev",sizeof(struct scull_dev),0,SLAB_HWCACHE_ALIGN,NULL);
+	scull_devices = kcalloc(scull_nr_devs,sizeof(struct scull_dev *),GFP_KERNEL);
+	if(!scull_dev_cache || !scull_devices)
 	{
 		err = -ENOMEM;
-		goto free_chrdev;
+		goto free_devices;
 	}
-	memset(scull_devices,0,scull_nr_devs*sizeof(struct scull_dev));
 
-	for(i=0;i<scull_nr_devs;i++) {
-		scull_devices[i].quantum = scull_quantum;
-		scull_devices[i].qset = scull_qset;
-		sema_init(&scull_devices[i].sem,1);
-		scull_setup_dev(&scull_devices[i],i);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+	scull_class = class_create("scull");
+#else
+	scull_class = class_create(THIS_MODULE,"scull");
+#endif
+	if(IS_ERR(scull_class)) {
+		err = PTR_ERR(scull_class);
+		goto free_devices;
 	}
+	err = scull_setup_cdev();
+	if(err)
+		goto destroy_class;
 	dev += scull_nr_devs;
 	dev += scull_p_init(dev);
 	dev += scull_access_init(dev);
+
+	/* carry on uncompressed if the algorithm is missing */
+	scull_z_init();
+	proc_create_single("scullmem",0,NULL,scull_proc_show);
 	return 0;
 
+destroy_class:
+	class_destroy(scull_class);
+free_devices:
+	kfree(scull_devices);
+	kmem_cache_destroy(scull_dev_cache);
+	scull_qset_exit();
 free_chrdev:
-	unregister_chrdev_region(MKDEV(scull_major,scull_minor),4);
+	unregister_chrdev_region(MKDEV(scull_major,scull_minor),scull_nr_devs);
 fail:
 	return err;
 }
@@ -234,15 +341,26 @@ static void __exit scull_exit(void)
 	dev_t devno = MKDEV(scull_major,scull_minor);
 	printk(KERN_ALERT"Destroy scull device.\n");
 
+	remove_proc_entry("scullmem",NULL);
+	scull_z_exit();
+	for(i=0;i<scull_nr_devs;i++)
+		device_destroy(scull_class,devno + i);
+	cdev_del(&scull_cdev);
 	for(i=0;i<scull_nr_devs;i++) {
-		scull_trim(scull_devices+i);
-		cdev_del(&scull_devices[i].cdev);	
+		if(!scull_devices[i])
+			continue;
+		scull_trim(scull_devices[i]);
+		kmem_cache_free(scull_dev_cache,scull_devices[i]);
 	}
 	kfree(scull_devices);
-	unregister_chrdev_region(devno,4);
+	kmem_cache_destroy(scull_dev_cache);
+	unregister_chrdev_region(devno,scull_nr_devs);
 
 	scull_p_exit();
 	scull_access_cleanup();
+	class_destroy(scull_class);
+	/* the access devices hand their quanta back above */
+	scull_qset_exit();
 }
 
 MODULE_LICENSE("GPL");
@@ -0,0 +1,53 @@
+/*
+ * Coalescing of SIGIO for scullpipe and the scull memory devices.
+ *
+ * A write signals the async readers only if a reader has run dry since
+ * the last signal: for a pipe a write after a reader found it empty,
+ * for a memory device a write that grows it after a reader hit the end.  A
+ * consumer that reads until EAGAIN (or end of file) on every SIGIO so
+ * never misses data, and a producer of small messages no longer sends
+ * one signal per write.
+ *
+ * For consumers that do not drain, scull_notify_bytes and scull_notify_ms
+ * add a signal once that many bytes have been written, or that much time
+ * has passed, since the last one.  scull_notify_bytes=1 restores the old
+ * signal-per-write behaviour.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/semaphore.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/jiffies.h>
+
+#include "scull.h"
+
+static unsigned int scull_notify_bytes;
+module_param(scull_notify_bytes, uint, 0644);
+MODULE_PARM_DESC(scull_notify_bytes, "Also send SIGIO after this many bytes since the last one (0: only when a reader ran dry)");
+
+static unsigned int scull_notify_ms;
+module_param(scull_notify_ms, uint, 0644);
+MODULE_PARM_DESC(scull_notify_ms, "Also send SIGIO when this many ms have passed since the last one (0: only when a reader ran dry)");
+
+/*
+ * Account a write of count bytes and decide whether it raises SIGIO.
+ * Called under the device's lock, or dev->grow for an appender.  The
+ * readers of a memory device clear signalled under a shared dev->sem,
+ * hence the _ONCE accesses.
+ */
+bool scull_notify_due(struct scull_notify *n,size_t count)
+{
+	n->bytes += count;
+	if(READ_ONCE(n->signalled) &&
+	   !(scull_notify_bytes && n->bytes >= scull_notify_bytes) &&
+	   !(scull_notify_ms && time_after_eq(jiffies, n->last + msecs_to_jiffies(scull_notify_ms))))
+		return false;
+	WRITE_ONCE(n->signalled, 1);
+	n->bytes = 0;
+	n->last = jiffies;
+	return true;
+}
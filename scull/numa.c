@@ -0,0 +1,137 @@
+/*
+ * NUMA placement of the scull memory devices.
+ *
+ * Every device has a home node: scull_numa_node if it is set, otherwise
+ * the online nodes are dealt out in turn (scull0 on the first, scull1 on
+ * the second, ...).  The scull_dev itself is allocated on its home node,
+ * and the policy decides where its quanta go:
+ *
+ *   first-touch  the node of the writer that allocates them (default)
+ *   interleave   the online nodes in turn, one quantum at a time
+ *   node         the home node
+ *
+ * scull_numa sets the policy of all devices at load time; SCULL_IOCSNUMA
+ * changes the policy and home node of one device.  Quanta that already
+ * exist stay where they are.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/cdev.h>
+#include <linux/semaphore.h>
+#include <linux/nodemask.h>
+#include <linux/string.h>
+
+#include "scull.h"
+
+static const char * const scull_numa_names[] = {
+	[SCULL_NUMA_FIRST_TOUCH] = "first-touch",
+	[SCULL_NUMA_INTERLEAVE] = "interleave",
+	[SCULL_NUMA_NODE] = "node",
+};
+
+static char *scull_numa = "first-touch";
+module_param(scull_numa, charp, 0444);
+MODULE_PARM_DESC(scull_numa, "Where quanta are allocated: first-touch, interleave or node (the device's home node)");
+
+static int scull_numa_node = NUMA_NO_NODE;
+module_param(scull_numa_node, int, 0444);
+MODULE_PARM_DESC(scull_numa_node, "Home node of every device (default: spread the devices over the online nodes)");
+
+static int scull_numa_policy = SCULL_NUMA_FIRST_TOUCH;
+
+static bool scull_numa_valid(int nid)
+{
+	return nid >= 0 && nid < nr_node_ids && node_online(nid);
+}
+
+int scull_numa_init(void)
+{
+	int policy = match_string(scull_numa_names, ARRAY_SIZE(scull_numa_names), scull_numa);
+
+	if(policy < 0) {
+		printk(KERN_ALERT "scull: unknown NUMA policy %s\n", scull_numa);
+		return -EINVAL;
+	}
+	if(scull_numa_node != NUMA_NO_NODE && !scull_numa_valid(scull_numa_node)) {
+		printk(KERN_ALERT "scull: node %d is not online\n", scull_numa_node);
+		return -EINVAL;
+	}
+	scull_numa_policy = policy;
+	return 0;
+}
+
+/* Home node of the index-th memory device. */
+int scull_numa_home(int index)
+{
+	int nid, n;
+
+	if(scull_numa_node != NUMA_NO_NODE)
+		return scull_numa_node;
+	n = index % num_online_nodes();
+	for_each_online_node(nid)
+		if(!n--)
+			return nid;
+	return first_online_node;
+}
+
+void scull_numa_setup(struct scull_dev *dev,int nid)
+{
+	dev->numa_policy = scull_numa_policy;
+	dev->numa_node = nid;
+	dev->numa_next = nid;
+}
+
+/* Node for the next quantum of dev; caller holds dev->sem. */
+int scull_numa_pick(struct scull_dev *dev)
+{
+	switch(dev->numa_policy) {
+	case SCULL_NUMA_INTERLEAVE:
+		dev->numa_next = next_node_in(dev->numa_next, node_online_map);
+		return dev->numa_next;
+	case SCULL_NUMA_NODE:
+		return dev->numa_node;
+	default:
+		return NUMA_NO_NODE;
+	}
+}
+
+/* Node of a kmalloc()ed buffer. */
+int scull_numa_of(const void *p)
+{
+	return page_to_nid(virt_to_page(p));
+}
+
+const char *scull_numa_name(int policy)
+{
+	if(policy < 0 || policy >= ARRAY_SIZE(scull_numa_names))
+		return "?";
+	return scull_numa_names[policy];
+}
+
+int scull_numa_set(struct scull_dev *dev,const struct scull_numa *arg)
+{
+	int nid = arg->node;
+
+	if(arg->policy < 0 || arg->policy >= ARRAY_SIZE(scull_numa_names))
+		return -EINVAL;
+	if(nid != NUMA_NO_NODE && !scull_numa_valid(nid))
+		return -EINVAL;
+
+	if(down_write_killable(&dev->sem))
+		return -ERESTARTSYS;
+	dev->numa_policy = arg->policy;
+	if(nid != NUMA_NO_NODE)
+		dev->numa_node = dev->numa_next = nid;
+	up_write(&dev->sem);
+	return 0;
+}
+
+void scull_numa_get(struct scull_dev *dev,struct scull_numa *arg)
+{
+	arg->policy = dev->numa_policy;
+	arg->node = dev->numa_node;
+}
@@ -13,10 +13,17 @@
 
 #include "scull.h"
 
-const int scull_p_nr_devs = 4;
+static int scull_p_nr_devs = 4;
+module_param(scull_p_nr_devs, int, 0444);
+MODULE_PARM_DESC(scull_p_nr_devs, "Number of scullpipe devices");
+
 const int scull_p_buffer =  4000;
 
-struct scull_pipe *scull_p_devices;
+/* allocated on first open, like the memory devices */
+struct scull_pipe **scull_p_devices;
+static DEFINE_MUTEX(scull_p_devices_lock);
+static struct kmem_cache *scull_p_cache;
+static struct cdev scull_p_cdev;
 
 dev_t scull_p_devno;
 
@@ -40,34 +47,43 @@ struct file_operations scull_p_fops = {
 	.fasync = scull_p_fasync,
 };
 
-struct scull_pipe {
-	wait_queue_head_t inq, outq;
-	char *buffer, *end;
-	int buffersize;
-	char *rp,*wp;
-	int nreaders,nwriters;
-	struct fasync_struct *async_queue;
-	struct mutex mutex;
-	struct cdev cdev;
-};
+static struct scull_pipe *scull_p_get(int index) {
+	struct scull_pipe *dev = smp_load_acquire(&scull_p_devices[index]);
+
+	if(dev)
+		return dev;
+	mutex_lock(&scull_p_devices_lock);
+	dev = scull_p_devices[index];
+	if(dev)
+		goto out;
+	dev = kmem_cache_zalloc(scull_p_cache,GFP_KERNEL);
+	if(!dev)
+		goto out;
+	init_waitqueue_head(&dev->inq);
+	init_waitqueue_head(&dev->outq);
+	mutex_init(&dev->mutex);
+	mutex_init(&dev->rlock);
+	mutex_init(&dev->wlock);
+	smp_store_release(&scull_p_devices[index],dev);
+out:
+	mutex_unlock(&scull_p_devices_lock);
+	return dev;
+}
 
 int scull_p_open(struct inode *inode,struct file *filp) {
 	struct scull_pipe *dev;
-	dev = container_of(inode->i_cdev,struct scull_pipe,cdev);
+	dev = scull_p_get(iminor(inode) - MINOR(scull_p_devno));
+	if(!dev)
+		return -ENOMEM;
 	filp->private_data = dev;
 
 	if(mutex_lock_interruptible(&dev->mutex))
 		return -ERESTARTSYS;
 	if(!dev->buffer) {
-		dev->buffer = kmalloc(scull_p_buffer, GFP_KERNEL);
-		if(!dev->buffer) {
+		if(scull_p_ring_init(dev,scull_p_buffer)) {
 			mutex_unlock(&dev->mutex);
 			return -ENOMEM;
 		}
-
-		dev->buffersize = scull_p_buffer;
-		dev->end = dev->buffer + dev->buffersize;
-		dev->rp = dev->wp = dev->buffer;
 	}
 
 	if(filp->f_mode & FMODE_READ)
@@ -88,132 +104,119 @@ int scull_p_release(struct inode *inode, struct file *filp) {
 		dev->nreaders --;
 	if(filp->f_mode & FMODE_WRITE)
 		dev->nwriters --;
-	if(dev->nreaders + dev->nwriters == 0) {
-		kfree(dev->buffer);
-		dev->buffer = NULL;
-	}
+	if(dev->nreaders + dev->nwriters == 0)
+		scull_p_ring_free(dev);
 	mutex_unlock(&dev->mutex);
 	return 0;
 }
 
+/*
+ * Readers and writers never take each other's lock (see ring.c).  A
+ * reader that finds the pipe empty sleeps on inq until it is not; a
+ * writer wakes inq after every write that somebody sleeps on, and
+ * readers likewise outq.  wq_has_sleeper() orders the new pointer
+ * before the check for sleepers, pairing with the barrier in
+ * prepare_to_wait() before the sleeper checks the pointer.
+ */
 ssize_t scull_p_read(struct file *filp, char __user *buf,size_t count, loff_t *f_pos) {
 	struct scull_pipe *dev = filp->private_data;
+	ssize_t result;
+
+	if(!count) return 0;
+	if(mutex_lock_interruptible(&dev->rlock)) return -ERESTARTSYS;
+
+	while(!(result = scull_p_ring_read(dev,buf,count))) {
+		/* run dry: re-arm SIGIO, then look again (see scull_p_write) */
+		if(dev->async_queue && READ_ONCE(dev->notify.signalled)) {
+			WRITE_ONCE(dev->notify.signalled,0);
+			smp_mb();
+			if(!scull_p_empty(dev))
+				continue;
+		}
+		mutex_unlock(&dev->rlock);
 
-	if(mutex_lock_interruptible(&dev->mutex)) return -ERESTARTSYS;
-
-	while(dev->rp == dev->wp) {
-		mutex_unlock(&dev->mutex);
-		
 		if(filp->f_flags & O_NONBLOCK)
 			return -EAGAIN;
 		PDEBUG("\"%s\" reading: going to sleep\n",current->comm);
-		if(wait_event_interruptible(dev->inq,(dev->rp != dev->wp)))
-			return -ERESTARTSYS;
-		
-		if(mutex_lock_interruptible(&dev->mutex))
+		if(wait_event_interruptible(dev->inq,!scull_p_empty(dev)))
 			return -ERESTARTSYS;
-	}
 
-	if(dev->wp > dev->rp)
-		count = min(count,(size_t)(dev->wp-dev->rp));
-	else
-		count = min(count,(size_t)(dev->end-dev->rp));
-	
-	if(copy_to_user(buf,dev->rp,count)) {
-		mutex_unlock(&dev->mutex);
-		return -EFAULT;
+		if(mutex_lock_interruptible(&dev->rlock))
+			return -ERESTARTSYS;
 	}
+	mutex_unlock(&dev->rlock);
+	if(result < 0)
+		return result;
+	count = result;
 
-	dev->rp += count;
-
-	if(dev->rp == dev->end)
-		dev->rp = dev->buffer;
-
-	mutex_unlock(&dev->mutex);
-
-	wake_up_interruptible(&dev->outq);
+	if(wq_has_sleeper(&dev->outq))
+		wake_up_interruptible(&dev->outq);
 	PDEBUG("\"%s\" did read %li bytes\n",current->comm,(long)count);
 	return count;
 }
 
-static int spacefree(struct scull_pipe *dev) {
-	if(dev->wp == dev->rp) return dev->buffersize-1;
-	return ((dev->wp + dev->buffersize - dev->rp) % dev->buffersize) -1;
-}
-
-static int scull_getwritespace(struct scull_pipe *dev,struct file *filp) {
-
-	while(spacefree(dev) == 0) {
-		DEFINE_WAIT(wait);
-		mutex_unlock(&dev->mutex);
-		if(filp->f_flags & O_NONBLOCK) return -EAGAIN;
-		PDEBUG("\"%s\" writing: going to sleep\n",current->comm);
-		prepare_to_wait(&dev->outq,&wait,TASK_INTERRUPTIBLE);
-		if(spacefree(dev) == 0)
-			schedule();
-		finish_wait(&dev->outq,&wait);
-		if(signal_pending(current))
-			return -ERESTARTSYS;
-		if(mutex_lock_interruptible(&dev->mutex))
-			return -ERESTARTSYS;
-	}
-	return 0;
-}
-
 ssize_t scull_p_write(struct file *filp,const char __user *buf,size_t count,loff_t *f_pos) {
 	struct scull_pipe *dev = filp->private_data;
-	int result;
+	ssize_t result;
+	int notify = 0;
 
-	if(mutex_lock_interruptible(&dev->mutex)) {
-		return -ERESTARTSYS;
-	}
+	if(!count) return 0;
+	if(mutex_lock_interruptible(&dev->wlock)) return -ERESTARTSYS;
 
-	result = scull_getwritespace(dev,filp);
-	if(result)
-		return result;//不需要释放mutex，scull_getwritespace已经处理了
+	PDEBUG("Going to accept up to %li bytes to %p from %p\n",(long)count, dev->wp,buf);
+	while(!(result = scull_p_ring_write(dev,buf,count))) {
+		mutex_unlock(&dev->wlock);
 
-	count = min(count,(size_t)spacefree(dev));
+		if(filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		PDEBUG("\"%s\" writing: going to sleep\n",current->comm);
+		if(wait_event_interruptible(dev->outq,scull_p_spacefree(dev) > 0))
+			return -ERESTARTSYS;
 
-	if(dev->wp >= dev->rp) {
-		count = min(count,(size_t)(dev->end - dev->wp));
-	} else {
-		count = min(count,(size_t)(dev->rp - dev->wp - 1));
+		if(mutex_lock_interruptible(&dev->wlock))
+			return -ERESTARTSYS;
 	}
-
-	PDEBUG("Going to accept %li bytes to %p from %p\n",(long)count, dev->wp,buf);
-
-	if(copy_from_user(dev->wp,buf,count)) {
-		mutex_unlock(&dev->mutex);
-		return -EFAULT;
+	if(result > 0 && dev->async_queue) {
+		/* pairs with the reader re-arming: it sees wp, or we see signalled clear */
+		smp_mb();
+		notify = scull_notify_due(&dev->notify,result);
 	}
-	dev->wp += count;
-	if(dev->wp == dev->end)
-		dev->wp = dev->buffer;
-	mutex_unlock(&dev->mutex);
+	mutex_unlock(&dev->wlock);
+	if(result < 0)
+		return result;
+	count = result;
 
-	wake_up_interruptible(&dev->inq);
+	if(wq_has_sleeper(&dev->inq))
+		wake_up_interruptible(&dev->inq);
 
-	if(dev->async_queue)
+	if(notify)
 		kill_fasync(&dev->async_queue,SIGIO,POLL_IN);
 	
 	PDEBUG("\"%s\" did write %li bytes\n",current->comm,(long) count);
 	return count;
 }
 
-static void scull_p_setup_cdev(struct scull_pipe *dev, int index) {
-	int err;
-	cdev_init(&dev->cdev,&scull_p_fops);
-	dev->cdev.owner = THIS_MODULE;
-	dev->cdev.ops = &scull_p_fops;
-	err = cdev_add(&dev->cdev,scull_p_devno + index,1);
-	if(err)
-		printk(KERN_ALERT"Error %d adding scull pipe %d",err,index);
+static int scull_p_setup_cdev(void) {
+	int err, i;
+	cdev_init(&scull_p_cdev,&scull_p_fops);
+	scull_p_cdev.owner = THIS_MODULE;
+	err = cdev_add(&scull_p_cdev,scull_p_devno,scull_p_nr_devs);
+	if(err) {
+		printk(KERN_ALERT"Error %d adding scull pipes",err);
+		return err;
+	}
+	for(i=0;i<scull_p_nr_devs;i++)
+		if(IS_ERR(device_create(scull_class,NULL,scull_p_devno + i,NULL,"scullpipe%d",i)))
+			printk(KERN_ALERT"Error creating the node of scullpipe%d",i);
+	return 0;
 }
 
 int scull_p_init(dev_t first_devno) 
 {
-	int result,i;
+	int result;
 
+	if(scull_p_nr_devs <= 0)
+		return 0;
 	result = register_chrdev_region(first_devno,scull_p_nr_devs,"scullp");
 	if(result < 0) {
 		printk(KERN_NOTICE "Unable to get scullp region, error %d\n", result);
@@ -222,24 +225,22 @@ int scull_p_init(dev_t first_devno)
 	
 	scull_p_devno = first_devno;
 
-	scull_p_devices = kmalloc(scull_p_nr_devs*sizeof(struct scull_pipe),GFP_KERNEL);
-	if(!scull_p_devices)
+	scull_p_cache = kmem_cache_create("scull_pipe",sizeof(struct scull_pipe),0,SLAB_HWCACHE_ALIGN,NULL);
+	scull_p_devices = kcalloc(scull_p_nr_devs,sizeof(struct scull_pipe *),GFP_KERNEL);
+	if(!scull_p_cache || !scull_p_devices)
 	{
 		printk(KERN_ALERT "Unable to malloc scullp devices, error %d\n", result);
-		goto free_chrdev;
-	}
-	memset(scull_p_devices,0,scull_p_nr_devs*sizeof(struct scull_pipe));
-
-	for(i=0;i<scull_p_nr_devs;i++) {
-		init_waitqueue_head(&(scull_p_devices[i].inq));
-		init_waitqueue_head(&(scull_p_devices[i].outq));
-		mutex_init(&scull_p_devices[i].mutex);
-		scull_p_setup_cdev(&scull_p_devices[i],i);
+		goto free_devices;
 	}
+	if(scull_p_setup_cdev())
+		goto free_devices;
 
 	return scull_p_nr_devs;
 
-free_chrdev:
+free_devices:
+	kfree(scull_p_devices);
+	scull_p_devices = NULL;
+	kmem_cache_destroy(scull_p_cache);
 	unregister_chrdev_region(first_devno,scull_p_nr_devs);
 fail:
 	return 0;
@@ -254,11 +255,17 @@ void scull_p_exit(void)
 
 	printk(KERN_ALERT"Destroy scull pipe devices.\n");
 
+	for(i=0;i<scull_p_nr_devs;i++)
+		device_destroy(scull_class,scull_p_devno + i);
+	cdev_del(&scull_p_cdev);
 	for(i=0;i<scull_p_nr_devs;i++) {
-		cdev_del(&scull_p_devices[i].cdev);
-		kfree(scull_p_devices[i].buffer);
+		if(!scull_p_devices[i])
+			continue;
+		kfree(scull_p_devices[i]->buffer);
+		kmem_cache_free(scull_p_cache,scull_p_devices[i]);
 	}
 	kfree(scull_p_devices);
+	kmem_cache_destroy(scull_p_cache);
 	unregister_chrdev_region(scull_p_devno,scull_p_nr_devs);
 	scull_p_devices = NULL;
 }
@@ -268,14 +275,13 @@ static unsigned int scull_p_poll(struct file *filp,poll_table *wait)
 	struct scull_pipe *dev = filp->private_data;
 	unsigned int mask = 0;
 
-	mutex_lock(&dev->mutex);
+	/* like the sleepers in read and write, no lock needed */
 	poll_wait(filp,&dev->inq,wait);
 	poll_wait(filp,&dev->outq,wait);
-	if(dev->rp != dev->wp)
+	if(!scull_p_empty(dev))
 		mask |= POLLIN | POLLRDNORM;
-	if(spacefree(dev))
+	if(scull_p_spacefree(dev))
 		mask |= POLLOUT | POLLWRNORM;
-	mutex_unlock(&dev->mutex);
 	return mask;
 }
 
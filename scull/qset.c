@@ -0,0 +1,922 @@
+/*
+ * The scull memory store: a chain of qsets, each holding an array of
+ * quantum-sized buffers.  This file has no dependency on the char device
+ * glue in main.c, so it also builds in user space against user/kshim.h.
+ */
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/cdev.h>
+#include <linux/rwsem.h>
+#include <linux/mutex.h>
+#include <linux/atomic.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/pagemap.h>
+#include <linux/jiffies.h>
+#include <linux/sched.h>
+#include <linux/err.h>
+#include <linux/topology.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#else
+#include "kshim.h"
+#endif
+
+#include "scull.h"
+
+int scull_quantum = 4000;
+int scull_qset = 1000;
+
+/*
+ * Node for the qsets and pointer arrays of dev: near the writer under
+ * first-touch, on the home node otherwise.
+ */
+static int scull_meta_node(struct scull_dev *dev) {
+	return dev->numa_policy == SCULL_NUMA_FIRST_TOUCH ? NUMA_NO_NODE : dev->numa_node;
+}
+
+/*
+ * Memory limits.  Every quantum that holds memory is charged once
+ * against scull_max_bytes, whichever devices share it, and counts
+ * against the dev->max_bytes of every device with a slot on it.  0
+ * means no limit.  Going over either limit fails with -ENOSPC.
+ */
+unsigned long scull_max_bytes;
+unsigned long scull_dev_max_bytes;
+static atomic_long_t scull_bytes;
+
+static int scull_charge(long n) {
+	unsigned long used = atomic_long_add_return(n * scull_quantum,&scull_bytes);
+
+	if(scull_max_bytes && used > scull_max_bytes) {
+		atomic_long_sub(n * scull_quantum,&scull_bytes);
+		return -ENOSPC;
+	}
+	return 0;
+}
+
+static void scull_uncharge(long n) {
+	atomic_long_sub(n * scull_quantum,&scull_bytes);
+}
+
+unsigned long scull_charged(void) {
+	return atomic_long_read(&scull_bytes);
+}
+
+/* Can dev take n more quanta?  Caller holds dev->sem, or dev->grow for an appender. */
+static int scull_dev_room(struct scull_dev *dev,int n) {
+	if(dev->max_bytes && dev->bytes + (unsigned long)n * dev->quantum > dev->max_bytes)
+		return -ENOSPC;
+	return 0;
+}
+
+/*
+ * Can the chain of dev grow to qset n?  The limits count quanta, but a
+ * write far past the end allocates every qset up to it, so the chain
+ * itself has to fit in them as well.  Qset numbers are ints.
+ */
+static int scull_chain_room(struct scull_dev *dev,long n) {
+	unsigned long need;
+
+	if(n > INT_MAX)
+		return -EFBIG;
+	need = (unsigned long)(n + 1) * sizeof(struct scull_qset);
+	if((dev->max_bytes && need > dev->max_bytes) || (scull_max_bytes && need > scull_max_bytes))
+		return -ENOSPC;
+	return 0;
+}
+
+/*
+ * Quantum descriptors and uncompressed quantum buffers come from their
+ * own caches, so that scull_reserve() can take them in bulk.  Every
+ * device uses scull_quantum-sized quanta.  Compressed images are
+ * kmalloc()ed (see compress.c).  All of it is charged to the memory
+ * cgroup of the task that allocates it.  Freed buffers go straight back
+ * to the cache, which keeps free objects per node and uncharges them, so
+ * scull holds no free memory of its own.
+ */
+static struct kmem_cache *scull_qbuf_cache, *scull_quantum_cache;
+
+int scull_qset_init(void) {
+	scull_qbuf_cache = kmem_cache_create("scull_qbuf",sizeof(struct scull_qbuf),0,SLAB_ACCOUNT,NULL);
+	if(!scull_qbuf_cache)
+		return -ENOMEM;
+	scull_quantum_cache = kmem_cache_create("scull_quantum",scull_quantum,0,SLAB_ACCOUNT,NULL);
+	if(!scull_quantum_cache) {
+		kmem_cache_destroy(scull_qbuf_cache);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+void scull_qset_exit(void) {
+	kmem_cache_destroy(scull_quantum_cache);
+	kmem_cache_destroy(scull_qbuf_cache);
+}
+
+void *scull_qdata_alloc(int nid) {
+	return kmem_cache_alloc_node(scull_quantum_cache,GFP_KERNEL,nid);
+}
+
+void scull_qdata_free(void *data) {
+	if(data)
+		kmem_cache_free(scull_quantum_cache,data);
+}
+
+static void scull_qbuf_init(struct scull_qbuf *qb,void *data) {
+	qb->data = data;
+	/* the allocator may have fallen back to another node */
+	qb->nid = scull_numa_of(data);
+	qb->clen = 0;
+	qb->atime = jiffies;
+	atomic_set(&qb->ref,1);
+	INIT_HLIST_NODE(&qb->hnode);
+}
+
+/* Returns the new quantum or ERR_PTR(-ENOSPC/-ENOMEM). */
+struct scull_qbuf *scull_qbuf_alloc(struct scull_dev *dev) {
+	struct scull_qbuf *qb;
+	void *data;
+	int nid = scull_numa_pick(dev);
+
+	if(scull_charge(1))
+		return ERR_PTR(-ENOSPC);
+	qb = kmem_cache_alloc_node(scull_qbuf_cache,GFP_KERNEL,nid);
+	if(!qb)
+		goto nomem;
+	data = scull_qdata_alloc(nid);
+	if(!data) {
+		kmem_cache_free(scull_qbuf_cache,qb);
+		goto nomem;
+	}
+	scull_qbuf_init(qb,data);
+	return qb;
+
+nomem:
+	scull_uncharge(1);
+	return ERR_PTR(-ENOMEM);
+}
+
+#define SCULL_RESERVE_BATCH 64
+
+/*
+ * Allocate n zeroed quanta for scull_reserve().  Under first-touch the
+ * descriptors and the buffers each take one kmem_cache_alloc_bulk()
+ * call; the other policies place every quantum on its own node.
+ */
+static int scull_qbuf_alloc_bulk(struct scull_dev *dev,int n,struct scull_qbuf **qbs) {
+	void *data[SCULL_RESERVE_BATCH];
+	int i;
+
+	if(dev->numa_policy != SCULL_NUMA_FIRST_TOUCH) {
+		for(i=0;i<n;i++) {
+			qbs[i] = scull_qbuf_alloc(dev);
+			if(IS_ERR(qbs[i])) {
+				int err = PTR_ERR(qbs[i]);
+
+				while(i--)
+					scull_qbuf_put(qbs[i]);
+				return err;
+			}
+			memset(qbs[i]->data,0,dev->quantum);
+		}
+		return 0;
+	}
+
+	if(scull_charge(n))
+		return -ENOSPC;
+	if(!kmem_cache_alloc_bulk(scull_qbuf_cache,GFP_KERNEL,n,(void **)qbs))
+		goto nomem;
+	if(!kmem_cache_alloc_bulk(scull_quantum_cache,GFP_KERNEL | __GFP_ZERO,n,data)) {
+		kmem_cache_free_bulk(scull_qbuf_cache,n,(void **)qbs);
+		goto nomem;
+	}
+	for(i=0;i<n;i++)
+		scull_qbuf_init(qbs[i],data[i]);
+	return 0;
+
+nomem:
+	scull_uncharge(n);
+	return -ENOMEM;
+}
+
+/* Drop one reference; the last one frees the quantum. */
+void scull_qbuf_put(struct scull_qbuf *qb) {
+	if(!qb || !atomic_dec_and_test(&qb->ref))
+		return;
+	scull_dd_forget(qb);
+	if(!scull_qbuf_zero(qb)) {
+		if(qb->clen)
+			kfree(qb->data);
+		else
+			scull_qdata_free(qb->data);
+		scull_uncharge(1);
+	}
+	kmem_cache_free(scull_qbuf_cache,qb);
+}
+
+/*
+ * Make the quantum readable in place: inflate it if the background scan
+ * compressed it, and mark it as recently used.  Zero quanta have nothing
+ * to inflate; readers check scull_qbuf_zero() themselves.
+ */
+static int scull_qbuf_get(struct scull_dev *dev,struct scull_qbuf *qb) {
+	/* a shared quantum may be inflated under another device's lock */
+	if(smp_load_acquire(&qb->clen)) {
+		int err = scull_z_inflate(dev,qb);
+		if(err)
+			return err;
+	}
+	/* readers under a shared dev->sem all stamp it */
+	WRITE_ONCE(qb->atime,jiffies);
+	return 0;
+}
+
+/*
+ * Return a quantum in *slot that this device may modify: allocate it if
+ * the slot is empty, give it real memory if it is a zero quantum, and
+ * copy it if it is shared with another slot.  Returns an ERR_PTR on
+ * failure.  Caller holds dev->sem exclusive: a quantum it replaces may
+ * be freed.
+ */
+static struct scull_qbuf *scull_qbuf_writable(struct scull_dev *dev,struct scull_qbuf **slot) {
+	struct scull_qbuf *qb = *slot, *copy;
+	int err;
+
+	/* an empty slot or a zero quantum is new memory for this device */
+	if((!qb || scull_qbuf_zero(qb)) && scull_dev_room(dev,1))
+		return ERR_PTR(-ENOSPC);
+
+	if(!qb) {
+		qb = scull_qbuf_alloc(dev);
+		if(IS_ERR(qb))
+			return qb;
+		/* the write may cover only part of it, and settle the rest */
+		memset(qb->data,0,dev->quantum);
+		dev->bytes += dev->quantum;
+		return *slot = qb;
+	}
+
+	/* only a quantum nobody else can reach is modified in place */
+	if(!scull_qbuf_zero(qb) && scull_dd_own(qb)) {
+		err = scull_qbuf_get(dev,qb);
+		return err ? ERR_PTR(err) : qb;
+	}
+
+	if(!scull_qbuf_zero(qb)) {
+		err = scull_qbuf_get(dev,qb);
+		if(err)
+			return ERR_PTR(err);
+	}
+	copy = scull_qbuf_alloc(dev);
+	if(IS_ERR(copy))
+		return copy;
+	if(scull_qbuf_zero(qb)) {
+		memset(copy->data,0,dev->quantum);
+		dev->bytes += dev->quantum;
+	} else
+		memcpy(copy->data,qb->data,dev->quantum);
+	scull_qbuf_put(qb);
+	return *slot = copy;
+}
+
+/*
+ * Called after a write that filled the last byte of a quantum, which
+ * is when a quantum written front to back, in one go or in pieces, is
+ * complete: all-zero data is not kept at all, anything else may be
+ * merged with an identical quantum.  O_APPEND writes do not get here.
+ */
+static void scull_qbuf_settle(struct scull_dev *dev,struct scull_qbuf **slot) {
+	struct scull_qbuf *qb = *slot;
+
+	if(!memchr_inv(qb->data,0,dev->quantum)) {
+		scull_qdata_free(qb->data);
+		qb->data = NULL;
+		scull_uncharge(1);
+		dev->bytes -= dev->quantum;
+		return;
+	}
+	*slot = scull_dd_share(dev,qb);
+}
+
+static struct scull_qset *scull_qset_alloc(struct scull_dev *dev) {
+	struct scull_qset *qs;
+
+	qs = kmalloc_node(sizeof(struct scull_qset),GFP_KERNEL_ACCOUNT,scull_meta_node(dev));
+	if(!qs)
+		return NULL;
+	memset(qs,0,sizeof(struct scull_qset));
+	atomic_set(&qs->ref,1);
+	return qs;
+}
+
+/* Drop one reference on qs; the last one frees it and releases its tail. */
+static void scull_qset_put(struct scull_qset *qs,int qset) {
+	struct scull_qset *next;
+	int i;
+
+	while(qs && atomic_dec_and_test(&qs->ref)) {
+		if(qs->data) {
+			for(i=0;i<qset;i++)
+				scull_qbuf_put(qs->data[i]);
+			kfree(qs->data);
+		}
+		next = qs->next;
+		kfree(qs);
+		qs = next;
+	}
+}
+
+/*
+ * Make the qset in *link private to this device.  A shared qset is
+ * replaced by a copy that takes references on its quanta and on the next
+ * qset, so the copy costs one array of pointers and no quantum data.
+ * Replacing a qset needs dev->sem exclusive; appenders only get here on
+ * a chain that scull_append_prepare() has already made private, and only
+ * the device itself adds references to its chain, with dev->sem held
+ * exclusive, so a count of 1 cannot go back up while they share it.
+ */
+static struct scull_qset *scull_qset_unshare(struct scull_dev *dev,struct scull_qset **link) {
+	struct scull_qset *old = *link, *qs;
+	int i;
+
+	if(atomic_read(&old->ref) == 1)
+		return old;
+
+	qs = scull_qset_alloc(dev);
+	if(!qs)
+		return NULL;
+	if(old->data) {
+		qs->data = kmalloc_node(dev->qset * sizeof(struct scull_qbuf *),GFP_KERNEL_ACCOUNT,scull_meta_node(dev));
+		if(!qs->data) {
+			kfree(qs);
+			return NULL;
+		}
+		for(i=0;i<dev->qset;i++) {
+			qs->data[i] = old->data[i];
+			if(qs->data[i])
+				atomic_inc(&qs->data[i]->ref);
+		}
+	}
+	qs->next = old->next;
+	if(qs->next)
+		atomic_inc(&qs->next->ref);
+	*link = qs;
+	scull_qset_put(old,dev->qset);
+	return qs;
+}
+
+/* Set up the locks and wait queues of a zeroed device. */
+void scull_dev_init(struct scull_dev *dev) {
+	init_rwsem(&dev->sem);
+	mutex_init(&dev->grow);
+	init_waitqueue_head(&dev->inq);
+	init_waitqueue_head(&dev->commitq);
+	dev->appendable = 1;
+}
+
+int scull_trim(struct scull_dev *dev) {
+	scull_qset_put(dev->data,dev->qset);
+
+	dev->appendable = 1;
+	dev->size = 0;
+	atomic_long_set(&dev->tail,0);
+	dev->bytes = 0;
+	dev->quantum = scull_quantum;
+	dev->qset = scull_qset;
+	dev->data = NULL;
+	return 0;
+}
+
+/*
+ * Return qset n of the device for writing, allocating the chain up to it
+ * and copying every shared qset on the way.  New qsets are published
+ * whole, for the readers that walk the chain alongside appenders.
+ */
+struct scull_qset *scull_follow(struct scull_dev *dev,int n) {
+	struct scull_qset **link = &dev->data, *qs;
+
+	for(;;) {
+		if(!*link) {
+			qs = scull_qset_alloc(dev);
+			if(!qs) return NULL;
+			smp_store_release(link,qs);
+		}
+		qs = scull_qset_unshare(dev,link);
+		if(!qs) return NULL;
+		if(!n--) return qs;
+		link = &qs->next;
+	}
+}
+
+/*
+ * Return qset n for reading, or NULL if the chain does not reach it.
+ * The acquires pair with the releases in scull_follow(), as appenders
+ * may be adding to the chain.
+ */
+struct scull_qset *scull_lookup(struct scull_dev *dev,int n) {
+	struct scull_qset *qs = smp_load_acquire(&dev->data);
+
+	while(qs && n--)
+		qs = smp_load_acquire(&qs->next);
+	return qs;
+}
+
+/* Give a qset its array of quantum pointers if it has none yet. */
+static int scull_qset_slots(struct scull_dev *dev,struct scull_qset *dptr) {
+	struct scull_qbuf **slots;
+
+	if(dptr->data)
+		return 0;
+	slots = kmalloc_node(dev->qset * sizeof(struct scull_qbuf *),GFP_KERNEL_ACCOUNT,scull_meta_node(dev));
+	if(!slots)
+		return -ENOMEM;
+	memset(slots,0,dev->qset * sizeof(struct scull_qbuf *));
+	/* readers see the array only once it is cleared */
+	smp_store_release(&dptr->data,slots);
+	return 0;
+}
+
+/*
+ * Return the quantum under byte pos for an appender, which holds
+ * dev->grow under a shared dev->sem.  On a chain that is appendable this
+ * only fills in missing qsets, slot arrays and quanta, each published
+ * once it is complete, so a reader walking the chain meanwhile finds
+ * either nothing or the finished object, and nothing it can reach is
+ * ever freed.  A new quantum reads as zeros before pos.
+ */
+static struct scull_qbuf *scull_qbuf_append(struct scull_dev *dev,long pos) {
+	long itemsize = (long)dev->quantum * dev->qset;
+	struct scull_qset *dptr;
+	struct scull_qbuf **slot, *qb;
+	int err;
+
+	err = scull_chain_room(dev,pos / itemsize);
+	if(err)
+		return ERR_PTR(err);
+	dptr = scull_follow(dev,pos / itemsize);
+	if(!dptr || scull_qset_slots(dev,dptr))
+		return ERR_PTR(-ENOMEM);
+	slot = &dptr->data[pos % itemsize / dev->quantum];
+	if(*slot) {
+		err = scull_qbuf_get(dev,*slot);
+		return err ? ERR_PTR(err) : *slot;
+	}
+
+	if(scull_dev_room(dev,1))
+		return ERR_PTR(-ENOSPC);
+	qb = scull_qbuf_alloc(dev);
+	if(IS_ERR(qb))
+		return qb;
+	memset(qb->data,0,pos % dev->quantum);
+	/* scull_ioctl() and /proc read it under a shared dev->sem */
+	WRITE_ONCE(dev->bytes,dev->bytes + dev->quantum);
+	smp_store_release(slot,qb);
+	return qb;
+}
+
+/*
+ * Make the chain appendable: copy every qset that is shared with a
+ * snapshot, so that appenders never replace one, and make every quantum
+ * from the end of the device on private or drop it.  Only the quantum
+ * the end falls into holds bytes of the device; a shared or zero
+ * quantum past it is merely unused memory (a reservation, say), and is
+ * given back rather than copied.  Caller holds dev->sem exclusive.
+ */
+static int scull_append_prepare(struct scull_dev *dev) {
+	struct scull_qset *dptr;
+	struct scull_qbuf *qb;
+	long first = dev->size / dev->quantum, idx;
+	int n = 0, i;
+
+	for(dptr = dev->data;dptr;dptr = dptr->next)
+		n++;
+	if(n && !scull_follow(dev,n - 1))
+		return -ENOMEM;
+
+	for(dptr = dev->data, idx = 0;dptr;dptr = dptr->next, idx += dev->qset) {
+		if(!dptr->data || idx + dev->qset <= first)
+			continue;
+		for(i = max(first - idx,0L);i<dev->qset;i++) {
+			qb = dptr->data[i];
+			if(!qb || (!scull_qbuf_zero(qb) && scull_dd_own(qb)))
+				continue;
+			if(idx + i == first && dev->size % dev->quantum) {
+				qb = scull_qbuf_writable(dev,&dptr->data[i]);
+				if(IS_ERR(qb))
+					return PTR_ERR(qb);
+				continue;
+			}
+			dptr->data[i] = NULL;
+			if(!scull_qbuf_zero(qb))
+				dev->bytes -= dev->quantum;
+			scull_qbuf_put(qb);
+		}
+	}
+	dev->appendable = 1;
+	return 0;
+}
+
+/*
+ * Populate the qsets and quanta covering [off, off + len) without
+ * changing the size of the device, so that later writes to the range
+ * never allocate.  Reserved quanta read back as zeros.  dev->sem is
+ * dropped after every SCULL_RESERVE_BATCH quanta, so writers are held
+ * up for one batch at a time rather than for the whole range.  Slots
+ * that are already populated are left alone.
+ */
+int scull_reserve(struct scull_dev *dev,loff_t off,loff_t len) {
+	struct scull_qbuf *qbs[SCULL_RESERVE_BATCH];
+	struct scull_qset *dptr;
+	long idx, last;
+	int qset, s_pos, n, want, i, err = 0;
+
+	if(off < 0 || len <= 0 || len > LLONG_MAX - off)
+		return -EINVAL;
+
+	if(down_write_killable(&dev->sem)) return -ERESTARTSYS;
+	idx = off / dev->quantum;
+	last = (off + len - 1) / dev->quantum;
+	err = scull_chain_room(dev,last / dev->qset);
+	if(err) {
+		up_write(&dev->sem);
+		return err;
+	}
+	while(idx <= last) {
+		qset = dev->qset;
+		dptr = scull_follow(dev,idx / qset);
+		if(!dptr || scull_qset_slots(dev,dptr)) {
+			err = -ENOMEM;
+			break;
+		}
+		s_pos = idx % qset;
+		n = min(last - idx + 1,(long)min(qset - s_pos,SCULL_RESERVE_BATCH));
+
+		/* only the empty slots of the batch need memory */
+		for(want=0,i=0;i<n;i++)
+			if(!dptr->data[s_pos+i])
+				want++;
+		if(want) {
+			err = scull_dev_room(dev,want);
+			if(!err)
+				err = scull_qbuf_alloc_bulk(dev,want,qbs);
+			if(err)
+				break;
+			dev->bytes += (unsigned long)want * dev->quantum;
+		}
+		for(i=0;i<n;i++)
+			if(!dptr->data[s_pos+i])
+				dptr->data[s_pos+i] = qbs[--want];
+		idx += n;
+
+		up_write(&dev->sem);
+		cond_resched();
+		if(down_write_killable(&dev->sem)) return -ERESTARTSYS;
+	}
+	up_write(&dev->sem);
+	return err;
+}
+
+/*
+ * Turn the empty device snap into a copy of dev that shares all of its
+ * memory.  This only takes a reference on the head of the chain; dev
+ * copies qsets and quanta as it writes to them.  Caller holds dev->sem.
+ */
+void scull_clone(struct scull_dev *dev,struct scull_dev *snap) {
+	snap->data = dev->data;
+	if(snap->data)
+		atomic_inc(&snap->data->ref);
+	snap->quantum = dev->quantum;
+	snap->qset = dev->qset;
+	snap->size = dev->size;
+	atomic_long_set(&snap->tail,dev->size);
+	snap->bytes = dev->bytes;
+	/* the next append on either side copies its way out first */
+	dev->appendable = 0;
+	snap->appendable = 0;
+}
+
+ssize_t scull_read(struct file *filp, char __user *buf,size_t count, loff_t *f_pos) {
+	struct scull_dev *dev = filp->private_data;
+	struct scull_qset *dptr;
+	struct scull_qbuf **slots, *qb = NULL;
+	int quantum = dev->quantum, qset = dev->qset;
+	int itemsize = quantum * qset;
+	int item, s_pos, q_pos, rest;
+	unsigned long size;
+	ssize_t retval = 0;
+
+	/*
+	 * Readers share dev->sem with each other and with appenders, and
+	 * read no further than the bytes appenders have committed.
+	 */
+	if(down_read_killable(&dev->sem)) return -ERESTARTSYS;
+	size = smp_load_acquire(&dev->size);
+	/* a reader that runs dry re-arms SIGIO for the next growing write */
+	if(*f_pos >= size) {
+		WRITE_ONCE(dev->notify.signalled,0);
+		/* an append that committed meanwhile may not have seen that */
+		smp_mb();
+		size = smp_load_acquire(&dev->size);
+		if(*f_pos >= size)
+			goto out;
+	}
+	if(*f_pos + count > size) count = size - *f_pos;
+
+	item = (long)*f_pos/itemsize;
+	rest = (long)*f_pos%itemsize;
+	s_pos = rest / quantum; q_pos = rest%quantum;
+
+	dptr = scull_lookup(dev,item);
+	/* appenders publish slot arrays and quanta with a release */
+	slots = dptr ? smp_load_acquire(&dptr->data) : NULL;
+	if(slots)
+		qb = smp_load_acquire(&slots[s_pos]);
+	if(!qb) goto out;
+	retval = scull_qbuf_get(dev,qb);
+	if(retval) goto out;
+
+	if(count > quantum - q_pos) count = quantum - q_pos;
+
+	if(scull_qbuf_zero(qb)) {
+		if(clear_user(buf,count)) {
+			retval = -EFAULT;
+			goto out;
+		}
+	} else if(copy_to_user(buf,qb->data + q_pos,count)) {
+		retval = -EFAULT;
+		goto out;
+	}
+
+	*f_pos += count;
+	retval = count;
+	if(*f_pos >= size)
+		WRITE_ONCE(dev->notify.signalled,0);
+
+out:
+	up_read(&dev->sem);
+	return retval;
+}
+
+/* An appender waiting for the appenders before it to commit. */
+struct scull_commit_wait {
+	struct wait_queue_entry wq;
+	long off;			/* where its reservation starts */
+};
+
+/* Wake only the appender whose reservation starts at the new size, key. */
+static int scull_commit_wake(struct wait_queue_entry *wq,unsigned int mode,int sync,void *key) {
+	struct scull_commit_wait *w = container_of(wq,struct scull_commit_wait,wq);
+
+	if(w->off != (long)key)
+		return 0;
+	return autoremove_wake_function(wq,mode,sync,key);
+}
+
+static void scull_commit_wait(struct scull_dev *dev,long off) {
+	struct scull_commit_wait w = { .off = off };
+
+	init_wait_func(&w.wq,scull_commit_wake);
+	for(;;) {
+		prepare_to_wait(&dev->commitq,&w.wq,TASK_UNINTERRUPTIBLE);
+		/* acquire, so the bytes of earlier appenders are ours to publish */
+		if(smp_load_acquire(&dev->size) == off)
+			break;
+		schedule();
+	}
+	finish_wait(&dev->commitq,&w.wq);
+}
+
+/*
+ * O_APPEND writes.  Appenders hold dev->sem shared, so they run alongside
+ * each other and alongside readers, but not alongside anything else.
+ * Each one reserves the bytes [off, end) at the tail with a cmpxchg on
+ * dev->tail, takes the quanta under them under dev->grow, copies the
+ * data straight from user space into them with no lock of its own,
+ * waits until all earlier reservations are committed and moves
+ * dev->size to end.  Readers stop at dev->size, so they never see bytes
+ * that are still being copied.  The commit wait is not interruptible, as
+ * an appender that gives up there would hold up every later one, but
+ * what it waits for is other appenders' allocations and copies.  Each
+ * commit wakes only the appender that is next in line.
+ *
+ * No page fault may fall between reserving and committing either, so
+ * the user buffer is faulted in first and copied with page faults
+ * disabled.  If a page went away in between, the append gives its
+ * reservation back and starts over.
+ *
+ * Appenders only ever add to the chain (see scull_qbuf_append()).  Once
+ * a snapshot shares it, the next append takes dev->sem exclusive once to
+ * copy what the appenders would otherwise have to replace.
+ *
+ * One call appends at most one quantum, and all of it or nothing, so
+ * records up to a quantum long stay whole: the two quanta a record can
+ * straddle are both taken before any of it is copied.  A failed append
+ * gives its reservation back if nobody reserved after it.  Otherwise the
+ * range is left as a hole of zeros, as with a sparse write, so that the
+ * appends after it can still commit.
+ */
+static ssize_t scull_append(struct file *filp,const char __user *buf,size_t count,loff_t *f_pos) {
+	struct scull_dev *dev = filp->private_data;
+	struct scull_qbuf *qbs[2];
+	int quantum = dev->quantum;
+	long off, pos, end, next;
+	int notify = 0, i;
+	ssize_t err;
+
+	if(count > quantum) count = quantum;
+	if(!count) return 0;
+
+retry:
+	if(fault_in_readable(buf,count))
+		return -EFAULT;
+	if(down_read_killable(&dev->sem))
+		return -ERESTARTSYS;
+	err = 0;
+	while(!dev->appendable) {
+		up_read(&dev->sem);
+		if(down_write_killable(&dev->sem))
+			return -ERESTARTSYS;
+		if(!dev->appendable)
+			err = scull_append_prepare(dev);
+		up_write(&dev->sem);
+		if(err)
+			return err;
+		if(down_read_killable(&dev->sem))
+			return -ERESTARTSYS;
+	}
+
+	off = atomic_long_read(&dev->tail);
+	while((pos = atomic_long_cmpxchg(&dev->tail,off,off + count)) != off)
+		off = pos;
+	end = off + count;
+
+	qbs[0] = qbs[1] = NULL;
+	mutex_lock(&dev->grow);
+	for(pos = off, i = 0;pos < end;pos = next, i++) {
+		next = min(end,(pos / quantum + 1) * quantum);
+		qbs[i] = scull_qbuf_append(dev,pos);
+		if(IS_ERR(qbs[i])) {
+			err = PTR_ERR(qbs[i]);
+			qbs[i] = NULL;
+			break;
+		}
+	}
+	mutex_unlock(&dev->grow);
+
+	if(!err) {
+		pagefault_disable();
+		for(pos = off, i = 0;pos < end;pos = next, i++) {
+			next = min(end,(pos / quantum + 1) * quantum);
+			if(copy_from_user(qbs[i]->data + pos % quantum,buf + (pos - off),next - pos)) {
+				err = -EFAULT;
+				break;
+			}
+		}
+		pagefault_enable();
+	}
+
+	if(err && atomic_long_cmpxchg(&dev->tail,end,off) == end) {
+		up_read(&dev->sem);
+		if(err == -EFAULT)
+			goto retry;
+		return err;
+	}
+	/* a hole that has to commit must not show stale memory */
+	for(pos = off, i = 0;err && pos < end;pos = next, i++) {
+		next = min(end,(pos / quantum + 1) * quantum);
+		if(qbs[i])
+			memset(qbs[i]->data + pos % quantum,0,next - pos);
+	}
+
+	/* commit in reservation order */
+	scull_commit_wait(dev,off);
+	smp_store_release(&dev->size,end);
+	if(wq_has_sleeper(&dev->commitq))
+		__wake_up(&dev->commitq,TASK_NORMAL,1,(void *)end);
+	/* pairs with scull_read(): it either sees the size or has re-armed */
+	smp_mb();
+	mutex_lock(&dev->grow);
+	notify = scull_notify_due(&dev->notify,count);
+	mutex_unlock(&dev->grow);
+	up_read(&dev->sem);
+
+	wake_up_interruptible(&dev->inq);
+	if(notify && dev->async_queue)
+		kill_fasync(&dev->async_queue,SIGIO,POLL_IN);
+	if(err)
+		return err;
+	*f_pos = end;
+	return count;
+}
+
+ssize_t scull_write(struct file *filp,const char __user *buf,size_t count,loff_t *f_pos) {
+	struct scull_dev *dev = filp->private_data;
+	struct scull_qset *dptr;
+	struct scull_qbuf *qb;
+	int quantum = dev->quantum, qset = dev->qset;
+	int itemsize = quantum * qset;
+	int s_pos,q_pos,rest;
+	long item;
+	int grew = 0, notify = 0;
+	ssize_t retval = -ENOMEM;
+
+	if(filp->f_flags & O_APPEND)
+		return scull_append(filp,buf,count,f_pos);
+
+	if(down_write_killable(&dev->sem)) return -ERESTARTSYS;
+
+	item = (long)*f_pos / itemsize;
+	rest = (long)*f_pos % itemsize;
+	s_pos = rest / quantum; q_pos = rest % quantum;
+
+	retval = scull_chain_room(dev,item);
+	if(retval) goto out;
+	retval = -ENOMEM;
+	dptr = scull_follow(dev,item);
+
+	if(dptr == NULL || scull_qset_slots(dev,dptr)) goto out;
+	qb = scull_qbuf_writable(dev,&dptr->data[s_pos]);
+	if(IS_ERR(qb)) {
+		retval = PTR_ERR(qb);
+		goto out;
+	}
+
+	if(count > quantum - q_pos) count = quantum - q_pos;
+
+	if(copy_from_user(qb->data + q_pos,buf,count)) {
+		retval = -EFAULT;
+		goto out;
+	}
+	if(q_pos + count == quantum)
+		scull_qbuf_settle(dev,&dptr->data[s_pos]);
+
+	*f_pos += count;
+	retval = count;
+
+	if(dev->size < *f_pos) {
+		/* scull_poll() looks at the size without the lock */
+		WRITE_ONCE(dev->size,*f_pos);
+		atomic_long_set(&dev->tail,dev->size);
+		grew = 1;
+		notify = scull_notify_due(&dev->notify,count);
+	}
+
+out:
+	up_write(&dev->sem);
+	if(grew)
+		wake_up_interruptible(&dev->inq);
+	if(notify && dev->async_queue)
+		kill_fasync(&dev->async_queue,SIGIO,POLL_IN);
+	return retval;
+}
+
+/*
+ * Walk the whole device and fill in st; caller holds dev->sem, shared
+ * or exclusive.  Appenders may add to the chain and readers may inflate
+ * quanta meanwhile, so everything is loaded the way scull_read() does.
+ * If nodes is not NULL it has an entry per node id and gets the number
+ * of quanta with memory on each node added to it.
+ */
+void scull_stats(struct scull_dev *dev,struct scull_stats *st,unsigned long *nodes) {
+	struct scull_qset *dptr;
+	struct scull_qbuf **slots;
+	unsigned int clen;
+	int i, snapped = 0;
+
+	memset(st,0,sizeof(*st));
+	st->size = smp_load_acquire(&dev->size);
+	for(dptr = smp_load_acquire(&dev->data);dptr;dptr = smp_load_acquire(&dptr->next)) {
+		st->qsets++;
+		/* from the first shared qset on, the chain belongs to snapshots too */
+		if(atomic_read(&dptr->ref) > 1)
+			snapped = 1;
+		st->snapped += snapped;
+		slots = smp_load_acquire(&dptr->data);
+		if(!slots)
+			continue;
+		for(i=0;i<dev->qset;i++) {
+			struct scull_qbuf *qb = smp_load_acquire(&slots[i]);
+
+			if(!qb)
+				continue;
+			st->quanta++;
+			/* a shared quantum is charged in equal parts to its users */
+			if(atomic_read(&qb->ref) > 1)
+				st->shared++;
+			if(!scull_qbuf_zero(qb) && nodes)
+				nodes[qb->nid]++;
+			clen = READ_ONCE(qb->clen);
+			if(scull_qbuf_zero(qb))
+				st->zero++;
+			else if(clen) {
+				st->compressed++;
+				st->stored += clen / atomic_read(&qb->ref);
+			} else
+				st->stored += dev->quantum / atomic_read(&qb->ref);
+		}
+	}
+}
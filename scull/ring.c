@@ -0,0 +1,115 @@
+/*
+ * The scullpipe ring buffer.  Sleeping, wakeups and signalling stay in
+ * pipe.c, so this file also builds in user space against user/kshim.h.
+ *
+ * The ring is single-producer single-consumer: readers hold dev->rlock
+ * and only move rp, writers hold dev->wlock and only move wp.  Each side
+ * hands bytes over to the other with a release store of its pointer,
+ * which the acquire load on the other side pairs with, so a reader and
+ * a writer never wait for each other.  Each side also keeps the last
+ * value it loaded of the other side's pointer, and only loads it again
+ * when that value does not cover a request, so a stream of transfers
+ * does not pull the other side's line over on every call.
+ */
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/cdev.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/semaphore.h>
+#include <linux/uaccess.h>
+#else
+#include "kshim.h"
+#endif
+
+#include "scull.h"
+
+int scull_p_ring_init(struct scull_pipe *dev,int size) {
+	dev->buffer = kmalloc(size, GFP_KERNEL);
+	if(!dev->buffer)
+		return -ENOMEM;
+
+	dev->buffersize = size;
+	dev->end = dev->buffer + dev->buffersize;
+	dev->rp = dev->wp = dev->buffer;
+	dev->rp_seen = dev->wp_seen = dev->buffer;
+	return 0;
+}
+
+void scull_p_ring_free(struct scull_pipe *dev) {
+	kfree(dev->buffer);
+	dev->buffer = NULL;
+}
+
+/* One byte always stays unused so that a full ring is not mistaken for empty. */
+static int scull_p_room(struct scull_pipe *dev,const char *rp,const char *wp) {
+	if(wp == rp) return dev->buffersize-1;
+	return ((rp + dev->buffersize - wp) % dev->buffersize) -1;
+}
+
+/* Free space and emptiness as of now, for either side, poll and sleepers. */
+int scull_p_spacefree(struct scull_pipe *dev) {
+	return scull_p_room(dev,smp_load_acquire(&dev->rp),smp_load_acquire(&dev->wp));
+}
+
+bool scull_p_empty(struct scull_pipe *dev) {
+	return smp_load_acquire(&dev->rp) == smp_load_acquire(&dev->wp);
+}
+
+/*
+ * Copy out at most one contiguous run of data, i.e. up to wp or up to the
+ * end of the buffer, whichever comes first.  Returns 0 if the ring is
+ * empty.  Caller holds dev->rlock.
+ */
+ssize_t scull_p_ring_read(struct scull_pipe *dev,char __user *buf,size_t count) {
+	char *rp = dev->rp, *wp = dev->wp_seen;
+
+	if((size_t)(dev->buffersize - 1 - scull_p_room(dev,rp,wp)) < count)
+		wp = dev->wp_seen = smp_load_acquire(&dev->wp);
+
+	if(wp >= rp)
+		count = min(count,(size_t)(wp-rp));
+	else
+		count = min(count,(size_t)(dev->end-rp));
+	if(!count)
+		return 0;
+
+	if(copy_to_user(buf,rp,count))
+		return -EFAULT;
+
+	rp += count;
+	if(rp == dev->end)
+		rp = dev->buffer;
+	/* the writer may reuse the bytes once it sees the new rp */
+	smp_store_release(&dev->rp,rp);
+	return count;
+}
+
+/* Counterpart of scull_p_ring_read; returns 0 if the ring is full.  Caller holds dev->wlock. */
+ssize_t scull_p_ring_write(struct scull_pipe *dev,const char __user *buf,size_t count) {
+	char *wp = dev->wp, *rp = dev->rp_seen;
+
+	if((size_t)scull_p_room(dev,rp,wp) < count)
+		rp = dev->rp_seen = smp_load_acquire(&dev->rp);
+
+	count = min(count,(size_t)scull_p_room(dev,rp,wp));
+	if(wp >= rp)
+		count = min(count,(size_t)(dev->end - wp));
+	else
+		count = min(count,(size_t)(rp - wp - 1));
+	if(!count)
+		return 0;
+
+	if(copy_from_user(wp,buf,count))
+		return -EFAULT;
+
+	wp += count;
+	if(wp == dev->end)
+		wp = dev->buffer;
+	/* the reader may copy the bytes out once it sees the new wp */
+	smp_store_release(&dev->wp,wp);
+	return count;
+}
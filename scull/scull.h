@@ -1,27 +1,213 @@
 #ifndef SCULL_H
 #define SCULL_H
 
+#include "scull_ioctl.h"
+
 extern int scull_quantum;
 extern int scull_qset;
+extern unsigned long scull_max_bytes;
+extern unsigned long scull_dev_max_bytes;
+
+/*
+ * One quantum of a memory device.  data holds dev->quantum raw bytes, the
+ * compressed image of them when clen is non-zero (see compress.c), or is
+ * NULL for a quantum that reads back as zeros.  A quantum may be shared
+ * by several slots (see dedup.c); it is only modified in place while ref
+ * is 1, otherwise writers copy it first.
+ */
+struct scull_qbuf {
+	void *data;
+	unsigned int clen;
+	unsigned long atime;
+	atomic_t ref;
+	u32 hash;
+	struct hlist_node hnode;
+	int nid;			/* node data was allocated on */
+};
+
+#define scull_qbuf_zero(qb) (!(qb)->data)
 
+/*
+ * One link of a device's chain.  Snapshots share the tail of the chain
+ * from the first qset on: a qset with ref > 1 and everything after it
+ * is read-only, and scull_follow() copies the qsets on the path to a
+ * write (see qset.c).
+ */
 struct scull_qset {
-	void **data;
+	struct scull_qbuf **data;
 	struct scull_qset *next;
+	atomic_t ref;
 };
 
+/*
+ * SIGIO coalescing state of a device (see notify.c).  signalled is set
+ * when SIGIO goes out and cleared when a reader finds nothing left, so
+ * a run of writes into a non-empty device raises one signal.
+ */
+struct scull_notify {
+	int signalled;
+	size_t bytes;			/* written since the last signal */
+	unsigned long last;		/* jiffies of the last signal */
+};
+
+/*
+ * Both structs are laid out by who writes what, so that the cores on
+ * either side of a device do not false-share lines: fields that are set
+ * up once and then only read come first, and each group of fields that
+ * is written together gets lines of its own.  Devices are allocated
+ * cache-aligned (SLAB_HWCACHE_ALIGN), so neighbouring devices never
+ * share a line either.
+ */
 struct scull_dev {
-	struct scull_qset *data;
+	/* read-mostly */
 	int quantum;
 	int qset;
-	unsigned long size;
+	unsigned long max_bytes;	/* limit on bytes, 0 for none */
 	unsigned int access_key;
-	struct semaphore sem;
-	struct cdev cdev;
+	int numa_policy;		/* SCULL_NUMA_* */
+	int numa_node;			/* home node */
+	struct fasync_struct *async_queue;
+
+	/*
+	 * The store.  Held shared by O_APPEND writers, which only fill in
+	 * missing parts of it under grow (see scull_append()), and exclusive
+	 * by everyone else.
+	 */
+	struct rw_semaphore sem ____cacheline_aligned_in_smp;
+	struct mutex grow;
+	struct scull_qset *data;
+	int appendable;			/* nothing shared from the end on */
+	unsigned long size;		/* committed: what readers see */
+	unsigned long bytes;		/* quanta with memory, in bytes */
+	int numa_next;			/* last node interleave used */
+	struct scull_notify notify;
+
+	/* appenders: end of the reserved bytes, and the commit order */
+	atomic_long_t tail ____cacheline_aligned_in_smp;
+	wait_queue_head_t commitq;
+
+	wait_queue_head_t inq ____cacheline_aligned_in_smp;	/* readers waiting for the size to grow */
+	struct cdev cdev;		/* the access devices' own; scull0.. share one */
+};
+
+/*
+ * The reader and the writer side of a pipe share no lock: readers only
+ * move rp and writers only move wp (see ring.c).  Each side's line holds
+ * its lock, its pointer, its last look at the other side's pointer, and
+ * the queue that the other side sleeps on, which it checks after every
+ * transfer.
+ */
+struct scull_pipe {
+	/* read-mostly */
+	char *buffer, *end;
+	int buffersize;
+	int nreaders,nwriters;
+	struct fasync_struct *async_queue;
+	struct mutex mutex;		/* open and release */
+
+	/* consumer side */
+	char *rp ____cacheline_aligned_in_smp;
+	char *wp_seen;
+	struct mutex rlock;
+	wait_queue_head_t outq;
+
+	/* producer side */
+	char *wp ____cacheline_aligned_in_smp;
+	char *rp_seen;
+	struct mutex wlock;
+	wait_queue_head_t inq;
+	struct scull_notify notify;
 };
 
 ssize_t scull_read(struct file *filp, char __user *buf,size_t count, loff_t *offp);
 ssize_t scull_write(struct file *filp,const char __user *buf,size_t count,loff_t *f_pos);
+void scull_dev_init(struct scull_dev *dev);
 int scull_trim(struct scull_dev *dev);
+struct scull_qset *scull_follow(struct scull_dev *dev,int n);
+struct scull_qset *scull_lookup(struct scull_dev *dev,int n);
+void scull_clone(struct scull_dev *dev,struct scull_dev *snap);
+struct scull_qbuf *scull_qbuf_alloc(struct scull_dev *dev);
+void scull_qbuf_put(struct scull_qbuf *qb);
+int scull_qset_init(void);
+void scull_qset_exit(void);
+void *scull_qdata_alloc(int nid);
+void scull_qdata_free(void *data);
+int scull_reserve(struct scull_dev *dev,loff_t off,loff_t len);
+unsigned long scull_charged(void);
+
+struct scull_stats {
+	unsigned long size;
+	unsigned long qsets;
+	unsigned long snapped;		/* qsets shared with a snapshot */
+	unsigned long quanta;
+	unsigned long compressed;
+	unsigned long zero;
+	unsigned long shared;
+	unsigned long stored;		/* bytes actually held for the quanta */
+};
+void scull_stats(struct scull_dev *dev,struct scull_stats *st,unsigned long *nodes);
+
+#ifdef __KERNEL__
+struct seq_file;
+
+extern struct scull_dev **scull_devices;
+extern int scull_nr_devs;
+extern struct class *scull_class;
+
+/* memory device i, or NULL if it was never opened */
+static inline struct scull_dev *scull_device(int i)
+{
+	return smp_load_acquire(&scull_devices[i]);
+}
+
+loff_t scull_llseek(struct file *filp,loff_t off,int whence);
+int scull_snapshot(struct scull_dev *dev);
+
+int scull_z_init(void);
+void scull_z_exit(void);
+int scull_z_inflate(struct scull_dev *dev,struct scull_qbuf *qb);
+int scull_z_deflate(struct scull_dev *dev,struct scull_qbuf *qb);
+bool scull_z_ready(void);
+int scull_z_setup(void);
+void scull_z_teardown(void);
+
+extern bool scull_dedup;
+struct scull_qbuf *scull_dd_share(struct scull_dev *dev,struct scull_qbuf *qb);
+void scull_dd_forget(struct scull_qbuf *qb);
+bool scull_dd_own(struct scull_qbuf *qb);
+void scull_dd_show(struct seq_file *m);
+
+bool scull_notify_due(struct scull_notify *n,size_t count);
+
+void scull_limit_show(struct seq_file *m);
+
+int scull_numa_init(void);
+int scull_numa_home(int index);
+void scull_numa_setup(struct scull_dev *dev,int nid);
+int scull_numa_pick(struct scull_dev *dev);
+int scull_numa_of(const void *p);
+const char *scull_numa_name(int policy);
+int scull_numa_set(struct scull_dev *dev,const struct scull_numa *arg);
+void scull_numa_get(struct scull_dev *dev,struct scull_numa *arg);
+#else
+/* nothing is ever compressed or deduplicated in the user-space build */
+static inline int scull_z_inflate(struct scull_dev *dev,struct scull_qbuf *qb) { return -EINVAL; }
+static inline struct scull_qbuf *scull_dd_share(struct scull_dev *dev,struct scull_qbuf *qb) { return qb; }
+static inline void scull_dd_forget(struct scull_qbuf *qb) { }
+static inline bool scull_dd_own(struct scull_qbuf *qb) { return atomic_read(&qb->ref) == 1; }
+/* nobody to signal */
+static inline bool scull_notify_due(struct scull_notify *n,size_t count) { return false; }
+/* and there is only one node */
+static inline int scull_numa_pick(struct scull_dev *dev) { return NUMA_NO_NODE; }
+static inline int scull_numa_of(const void *p) { return 0; }
+#endif
+
+int scull_p_ring_init(struct scull_pipe *dev,int size);
+void scull_p_ring_free(struct scull_pipe *dev);
+int scull_p_spacefree(struct scull_pipe *dev);
+bool scull_p_empty(struct scull_pipe *dev);
+ssize_t scull_p_ring_read(struct scull_pipe *dev,char __user *buf,size_t count);
+ssize_t scull_p_ring_write(struct scull_pipe *dev,const char __user *buf,size_t count);
 
 int scull_p_init(dev_t first_devno);
 void scull_p_exit(void);
@@ -0,0 +1,48 @@
+#ifndef SCULL_IOCTL_H
+#define SCULL_IOCTL_H
+
+/*
+ * ioctl commands of the scull memory devices.  Kept apart from scull.h so
+ * that user programs can include it without the driver's structures.
+ */
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define SCULL_IOC_MAGIC	'k'
+
+/* returns a new read-only file descriptor on a snapshot of the device */
+#define SCULL_IOCSNAPSHOT	_IO(SCULL_IOC_MAGIC, 1)
+
+/* where the quanta of a device are allocated, see numa.c */
+#define SCULL_NUMA_FIRST_TOUCH	0	/* on the node of the writer */
+#define SCULL_NUMA_INTERLEAVE	1	/* round robin over the online nodes */
+#define SCULL_NUMA_NODE		2	/* on the device's home node */
+
+struct scull_numa {
+	int policy;
+	int node;			/* home node, -1 to keep the current one */
+};
+
+#define SCULL_IOCSNUMA	_IOW(SCULL_IOC_MAGIC, 2, struct scull_numa)
+#define SCULL_IOCGNUMA	_IOR(SCULL_IOC_MAGIC, 3, struct scull_numa)
+
+/* populate the memory for a byte range up front; the size is unchanged */
+struct scull_range {
+	__u64 off;
+	__u64 len;
+};
+
+#define SCULL_IOCRESERVE	_IOW(SCULL_IOC_MAGIC, 4, struct scull_range)
+
+/* per-device memory limit in bytes (0: none) and current usage */
+struct scull_limit {
+	__u64 max_bytes;
+	__u64 bytes;			/* read only */
+};
+
+#define SCULL_IOCSLIMIT	_IOW(SCULL_IOC_MAGIC, 5, struct scull_limit)
+#define SCULL_IOCGLIMIT	_IOR(SCULL_IOC_MAGIC, 6, struct scull_limit)
+
+#define SCULL_IOC_MAXNR	6
+
+#endif
@@ -0,0 +1,782 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * KUnit tests for the scull store (qset.c) and the scullpipe ring (ring.c).
+ *
+ * Built into scull.ko when CONFIG_SCULL_KUNIT_TEST is set, so the suites
+ * run when the module loads; see .kunitconfig for running them under UML
+ * with kunit.py.  The two *_bench cases are timed microbenchmarks and
+ * only report numbers through kunit_info().
+ */
+#include <kunit/test.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/cdev.h>
+#include <linux/mman.h>
+#include <linux/semaphore.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/ktime.h>
+#include <linux/uaccess.h>
+#include <linux/string.h>
+#include <linux/nodemask.h>
+
+#include "scull.h"
+
+#define SCULL_TEST_UBUF	(64 * 1024)
+
+struct scull_test_ctx {
+	struct scull_dev dev;
+	struct file filp;
+	char __user *ubuf;
+	char *kbuf;
+};
+
+static int scull_test_init(struct kunit *test)
+{
+	struct scull_test_ctx *ctx;
+	unsigned long addr;
+
+	ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ctx);
+	ctx->kbuf = kunit_kzalloc(test, SCULL_TEST_UBUF, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ctx->kbuf);
+
+	/* scull_read/write and the ring only take __user buffers */
+	addr = kunit_vm_mmap(test, NULL, 0, SCULL_TEST_UBUF,
+			     PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, 0);
+	KUNIT_ASSERT_NE_MSG(test, addr, 0, "could not create user mapping");
+	ctx->ubuf = (char __user *)addr;
+
+	ctx->dev.quantum = scull_quantum;
+	ctx->dev.qset = scull_qset;
+	scull_dev_init(&ctx->dev);
+	ctx->filp.private_data = &ctx->dev;
+
+	test->priv = ctx;
+	return 0;
+}
+
+static void scull_test_exit(struct kunit *test)
+{
+	struct scull_test_ctx *ctx = test->priv;
+
+	scull_trim(&ctx->dev);
+}
+
+static ssize_t scull_test_write(struct scull_test_ctx *ctx, const char *src, size_t count, loff_t off)
+{
+	if(copy_to_user(ctx->ubuf, src, count))
+		return -EFAULT;
+	return scull_write(&ctx->filp, ctx->ubuf, count, &off);
+}
+
+static ssize_t scull_test_read(struct scull_test_ctx *ctx, char *dst, size_t count, loff_t off)
+{
+	ssize_t n = scull_read(&ctx->filp, ctx->ubuf, count, &off);
+
+	if(n > 0 && copy_from_user(dst, ctx->ubuf, n))
+		return -EFAULT;
+	return n;
+}
+
+static void scull_follow_test(struct kunit *test)
+{
+	struct scull_test_ctx *ctx = test->priv;
+	struct scull_qset *first, *third;
+
+	third = scull_follow(&ctx->dev, 2);
+	KUNIT_ASSERT_NOT_NULL(test, third);
+	first = ctx->dev.data;
+	KUNIT_ASSERT_NOT_NULL(test, first);
+
+	/* the chain up to the requested item is created, nothing beyond it */
+	KUNIT_EXPECT_PTR_EQ(test, first->next->next, third);
+	KUNIT_EXPECT_NULL(test, third->next);
+	KUNIT_EXPECT_NULL(test, third->data);
+
+	/* following again walks the existing chain */
+	KUNIT_EXPECT_PTR_EQ(test, scull_follow(&ctx->dev, 0), first);
+	KUNIT_EXPECT_PTR_EQ(test, scull_follow(&ctx->dev, 2), third);
+}
+
+static void scull_partial_quantum_write_test(struct kunit *test)
+{
+	struct scull_test_ctx *ctx = test->priv;
+	int quantum = ctx->dev.quantum;
+	char *out = ctx->kbuf;
+	ssize_t n;
+
+	/* a write crossing a quantum boundary stops at the boundary */
+	n = scull_test_write(ctx, "0123456789", 10, quantum - 4);
+	KUNIT_EXPECT_EQ(test, n, 4);
+	KUNIT_EXPECT_EQ(test, ctx->dev.size, (unsigned long)quantum);
+
+	n = scull_test_write(ctx, "456789", 6, quantum);
+	KUNIT_EXPECT_EQ(test, n, 6);
+	KUNIT_EXPECT_EQ(test, ctx->dev.size, (unsigned long)quantum + 6);
+
+	/* so does a read, and reads never go past the end of the data */
+	n = scull_test_read(ctx, out, 10, quantum - 4);
+	KUNIT_EXPECT_EQ(test, n, 4);
+	KUNIT_EXPECT_MEMEQ(test, out, "0123", 4);
+	n = scull_test_read(ctx, out, 10, quantum);
+	KUNIT_EXPECT_EQ(test, n, 6);
+	KUNIT_EXPECT_MEMEQ(test, out, "456789", 6);
+	KUNIT_EXPECT_EQ(test, scull_test_read(ctx, out, 10, quantum + 6), 0);
+}
+
+static void scull_qset_boundary_test(struct kunit *test)
+{
+	struct scull_test_ctx *ctx = test->priv;
+	loff_t itemsize = (loff_t)ctx->dev.quantum * ctx->dev.qset;
+	char *out = ctx->kbuf;
+
+	/* the first byte of the second qset lands in a new scull_qset */
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "x", 1, itemsize), 1);
+	KUNIT_ASSERT_NOT_NULL(test, ctx->dev.data);
+	KUNIT_ASSERT_NOT_NULL(test, ctx->dev.data->next);
+	KUNIT_EXPECT_NULL(test, ctx->dev.data->data);
+	KUNIT_EXPECT_EQ(test, ctx->dev.size, (unsigned long)itemsize + 1);
+	KUNIT_EXPECT_EQ(test, scull_test_read(ctx, out, 1, itemsize), 1);
+	KUNIT_EXPECT_EQ(test, out[0], 'x');
+}
+
+static void scull_trim_test(struct kunit *test)
+{
+	struct scull_test_ctx *ctx = test->priv;
+
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "abc", 3, 0), 3);
+	KUNIT_EXPECT_EQ(test, scull_trim(&ctx->dev), 0);
+	KUNIT_EXPECT_NULL(test, ctx->dev.data);
+	KUNIT_EXPECT_EQ(test, ctx->dev.size, 0UL);
+	KUNIT_EXPECT_EQ(test, ctx->dev.quantum, scull_quantum);
+	KUNIT_EXPECT_EQ(test, ctx->dev.qset, scull_qset);
+
+	/* trimming an empty device is harmless */
+	KUNIT_EXPECT_EQ(test, scull_trim(&ctx->dev), 0);
+}
+
+static void scull_stats_test(struct kunit *test)
+{
+	struct scull_test_ctx *ctx = test->priv;
+	int quantum = ctx->dev.quantum;
+	struct scull_stats st;
+
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "a", 1, 0), 1);
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "b", 1, 3 * quantum), 1);
+	scull_stats(&ctx->dev, &st, NULL);
+	KUNIT_EXPECT_EQ(test, st.size, 3UL * quantum + 1);
+	KUNIT_EXPECT_EQ(test, st.qsets, 1UL);
+	KUNIT_EXPECT_EQ(test, st.quanta, 2UL);
+	KUNIT_EXPECT_EQ(test, st.compressed, 0UL);
+	KUNIT_EXPECT_EQ(test, st.stored, 2UL * quantum);
+}
+
+static void scull_zero_quantum_test(struct kunit *test)
+{
+	struct scull_test_ctx *ctx = test->priv;
+	int quantum = ctx->dev.quantum;
+	char *out = ctx->kbuf;
+	struct scull_qbuf *qb;
+
+	/* a full quantum of zeros keeps no memory but reads back as zeros */
+	memset(out, 0, quantum);
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, out, quantum, 0), (ssize_t)quantum);
+	qb = ctx->dev.data->data[0];
+	KUNIT_ASSERT_NOT_NULL(test, qb);
+	KUNIT_EXPECT_TRUE(test, scull_qbuf_zero(qb));
+	memset(out, 0xff, quantum);
+	KUNIT_EXPECT_EQ(test, scull_test_read(ctx, out, quantum, 0), (ssize_t)quantum);
+	KUNIT_EXPECT_NULL(test, memchr_inv(out, 0, quantum));
+
+	/* a partial write into it materialises the zeros around the new data */
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "z", 1, 5), 1);
+	KUNIT_EXPECT_FALSE(test, scull_qbuf_zero(ctx->dev.data->data[0]));
+	KUNIT_EXPECT_EQ(test, scull_test_read(ctx, out, 7, 0), 7);
+	KUNIT_EXPECT_MEMEQ(test, out, "\0\0\0\0\0z\0", 7);
+
+	/* so is one written in pieces, once the last of them fills it */
+	memset(out, 0, quantum);
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, out, 10, quantum), 10);
+	KUNIT_EXPECT_FALSE(test, scull_qbuf_zero(ctx->dev.data->data[1]));
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, out, quantum - 10, quantum + 10), (ssize_t)quantum - 10);
+	KUNIT_EXPECT_TRUE(test, scull_qbuf_zero(ctx->dev.data->data[1]));
+	KUNIT_EXPECT_EQ(test, ctx->dev.bytes, (unsigned long)quantum);
+}
+
+static void scull_shared_quantum_cow_test(struct kunit *test)
+{
+	struct scull_test_ctx *ctx = test->priv;
+	int quantum = ctx->dev.quantum;
+	struct scull_qset *dptr;
+	struct scull_qbuf *qb;
+	char *out = ctx->kbuf;
+
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "shared", 6, 0), 6);
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "shared", 6, quantum), 6);
+	dptr = ctx->dev.data;
+
+	/* let slot 1 share slot 0's quantum, as dedup would */
+	qb = dptr->data[0];
+	atomic_inc(&qb->ref);
+	scull_qbuf_put(dptr->data[1]);
+	dptr->data[1] = qb;
+
+	/* writing through slot 1 copies; slot 0 keeps the old contents */
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "S", 1, quantum), 1);
+	KUNIT_EXPECT_PTR_NE(test, dptr->data[1], qb);
+	KUNIT_EXPECT_PTR_EQ(test, dptr->data[0], qb);
+	KUNIT_EXPECT_EQ(test, atomic_read(&qb->ref), 1);
+	KUNIT_EXPECT_EQ(test, scull_test_read(ctx, out, 6, 0), 6);
+	KUNIT_EXPECT_MEMEQ(test, out, "shared", 6);
+	KUNIT_EXPECT_EQ(test, scull_test_read(ctx, out, 6, quantum), 6);
+	KUNIT_EXPECT_MEMEQ(test, out, "Shared", 6);
+}
+
+static void scull_compress_test(struct kunit *test)
+{
+	struct scull_test_ctx *ctx = test->priv;
+	int quantum = ctx->dev.quantum, i;
+	char *in = ctx->kbuf, *out = ctx->kbuf + quantum;
+	bool setup = !scull_z_ready();
+	struct scull_qbuf *qb;
+
+	/* without scull_compress=1 nothing is set up yet */
+	if(setup && scull_z_setup())
+		kunit_skip(test, "compression algorithm unavailable");
+
+	for(i=0;i<quantum;i++)
+		in[i] = 'a' + i / 64 % 26;
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, in, quantum, 0), (ssize_t)quantum);
+	qb = ctx->dev.data->data[0];
+	KUNIT_EXPECT_EQ(test, scull_z_deflate(&ctx->dev, qb), 0);
+	KUNIT_EXPECT_NE(test, qb->clen, 0U);
+	KUNIT_EXPECT_LT(test, qb->clen, (unsigned int)quantum);
+
+	/* a read inflates it and gets back what was written */
+	KUNIT_EXPECT_EQ(test, scull_test_read(ctx, out, quantum, 0), (ssize_t)quantum);
+	KUNIT_EXPECT_MEMEQ(test, out, in, quantum);
+	KUNIT_EXPECT_EQ(test, qb->clen, 0U);
+
+	/* so does a write, which then changes the inflated bytes in place */
+	KUNIT_EXPECT_EQ(test, scull_z_deflate(&ctx->dev, qb), 0);
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "Z", 1, 10), 1);
+	KUNIT_EXPECT_PTR_EQ(test, ctx->dev.data->data[0], qb);
+	KUNIT_EXPECT_EQ(test, qb->clen, 0U);
+	in[10] = 'Z';
+	KUNIT_EXPECT_EQ(test, scull_test_read(ctx, out, quantum, 0), (ssize_t)quantum);
+	KUNIT_EXPECT_MEMEQ(test, out, in, quantum);
+
+	if(setup)
+		scull_z_teardown();
+}
+
+static void scull_dedup_test(struct kunit *test)
+{
+	struct scull_test_ctx *ctx = test->priv;
+	int quantum = ctx->dev.quantum;
+	unsigned long charged = scull_charged();
+	bool saved = scull_dedup;
+	struct scull_qset *dptr;
+	struct scull_qbuf *qb;
+	char *out = ctx->kbuf;
+
+	scull_dedup = true;
+
+	/* a second full quantum with the same contents is a hit in the table */
+	memset(out, 'd', quantum);
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, out, quantum, 0), (ssize_t)quantum);
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, out, quantum, quantum), (ssize_t)quantum);
+	dptr = ctx->dev.data;
+	qb = dptr->data[0];
+	KUNIT_EXPECT_PTR_EQ(test, dptr->data[1], qb);
+	KUNIT_EXPECT_EQ(test, atomic_read(&qb->ref), 2);
+	KUNIT_EXPECT_EQ(test, scull_charged(), charged + quantum);
+
+	/* writing through slot 1 copies; slot 0 keeps the old contents */
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "D", 1, quantum), 1);
+	KUNIT_EXPECT_PTR_NE(test, dptr->data[1], qb);
+	KUNIT_EXPECT_PTR_EQ(test, dptr->data[0], qb);
+	KUNIT_EXPECT_EQ(test, atomic_read(&qb->ref), 1);
+	KUNIT_EXPECT_EQ(test, scull_test_read(ctx, out, 1, 0), 1);
+	KUNIT_EXPECT_EQ(test, scull_test_read(ctx, out + 1, 1, quantum), 1);
+	KUNIT_EXPECT_MEMEQ(test, out, "dD", 2);
+
+	/* the original is still in the table for the next identical quantum */
+	memset(out, 'd', quantum);
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, out, quantum, 2 * quantum), (ssize_t)quantum);
+	KUNIT_EXPECT_PTR_EQ(test, dptr->data[2], qb);
+	KUNIT_EXPECT_EQ(test, atomic_read(&qb->ref), 2);
+
+	scull_dedup = saved;
+}
+
+static void scull_numa_test(struct kunit *test)
+{
+	struct scull_test_ctx *ctx = test->priv;
+	int quantum = ctx->dev.quantum, nid = first_online_node, i;
+	unsigned long *nodes, sum = 0;
+	struct scull_stats st;
+
+	nodes = kunit_kcalloc(test, nr_node_ids, sizeof(*nodes), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, nodes);
+
+	/* pinned to the home node, every quantum lands there */
+	scull_numa_setup(&ctx->dev, nid);
+	ctx->dev.numa_policy = SCULL_NUMA_NODE;
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "a", 1, 0), 1);
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "b", 1, quantum), 1);
+	KUNIT_EXPECT_EQ(test, ctx->dev.data->data[0]->nid, nid);
+	KUNIT_EXPECT_EQ(test, ctx->dev.data->data[1]->nid, nid);
+
+	/* interleaved quanta are spread, but each is counted exactly once */
+	ctx->dev.numa_policy = SCULL_NUMA_INTERLEAVE;
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "c", 1, 2 * quantum), 1);
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "d", 1, 3 * quantum), 1);
+	scull_stats(&ctx->dev, &st, nodes);
+	for(i=0;i<nr_node_ids;i++)
+		sum += nodes[i];
+	KUNIT_EXPECT_EQ(test, sum, st.quanta);
+	KUNIT_EXPECT_GE(test, nodes[nid], 2UL);
+}
+
+static void scull_reserve_test(struct kunit *test)
+{
+	struct scull_test_ctx *ctx = test->priv;
+	int quantum = ctx->dev.quantum;
+	struct scull_qbuf *qb;
+	char *out = ctx->kbuf;
+
+	/* reserving populates the slots but leaves the size alone */
+	KUNIT_EXPECT_EQ(test, scull_reserve(&ctx->dev, quantum / 2, 2 * quantum), 0);
+	KUNIT_EXPECT_EQ(test, ctx->dev.size, 0UL);
+	KUNIT_ASSERT_NOT_NULL(test, ctx->dev.data);
+	KUNIT_ASSERT_NOT_NULL(test, ctx->dev.data->data);
+	KUNIT_EXPECT_NOT_NULL(test, ctx->dev.data->data[0]);
+	KUNIT_EXPECT_NOT_NULL(test, ctx->dev.data->data[2]);
+	KUNIT_EXPECT_NULL(test, ctx->dev.data->data[3]);
+
+	/* a write into the range uses the reserved quantum as it is */
+	qb = ctx->dev.data->data[2];
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "r", 1, 2 * quantum + 1), 1);
+	KUNIT_EXPECT_PTR_EQ(test, ctx->dev.data->data[2], qb);
+
+	/* and the reserved bytes below it read back as zeros */
+	KUNIT_EXPECT_EQ(test, scull_test_read(ctx, out, 3, 2 * quantum), 2);
+	KUNIT_EXPECT_MEMEQ(test, out, "\0r", 2);
+	KUNIT_EXPECT_EQ(test, scull_test_read(ctx, out, 1, quantum), 1);
+	KUNIT_EXPECT_EQ(test, out[0], 0);
+
+	KUNIT_EXPECT_EQ(test, scull_reserve(&ctx->dev, -1, 1), -EINVAL);
+	KUNIT_EXPECT_EQ(test, scull_reserve(&ctx->dev, 0, 0), -EINVAL);
+}
+
+static void scull_limit_test(struct kunit *test)
+{
+	struct scull_test_ctx *ctx = test->priv;
+	int quantum = ctx->dev.quantum;
+	unsigned long saved = scull_max_bytes;
+	char *zeros = ctx->kbuf;
+
+	/* the device limit counts whole quanta */
+	ctx->dev.max_bytes = 2 * quantum;
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "a", 1, 0), 1);
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "b", 1, quantum), 1);
+	KUNIT_EXPECT_EQ(test, ctx->dev.bytes, 2UL * quantum);
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "c", 1, 2 * quantum), -ENOSPC);
+	KUNIT_EXPECT_EQ(test, scull_reserve(&ctx->dev, 2 * quantum, 1), -ENOSPC);
+	/* so does the chain of qsets up to an offset far past the end */
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "e", 1, 1000LL * quantum * ctx->dev.qset), -ENOSPC);
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "A", 1, 1), 1);
+
+	/* a quantum written full of zeros gives its memory back */
+	memset(zeros, 0, quantum);
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, zeros, quantum, quantum), (ssize_t)quantum);
+	KUNIT_EXPECT_EQ(test, ctx->dev.bytes, (unsigned long)quantum);
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "c", 1, 2 * quantum), 1);
+
+	/* the global limit applies to all devices together */
+	ctx->dev.max_bytes = 0;
+	scull_max_bytes = scull_charged();
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "d", 1, 3 * quantum), -ENOSPC);
+	scull_max_bytes = saved;
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "d", 1, 3 * quantum), 1);
+}
+
+static void scull_append_test(struct kunit *test)
+{
+	struct scull_test_ctx *ctx = test->priv;
+	int quantum = ctx->dev.quantum;
+	char *buf = ctx->kbuf, out[4];
+
+	/* the offset is ignored, appends go to the end */
+	ctx->filp.f_flags = O_WRONLY | O_APPEND;
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "ab", 2, 100), 2);
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "cd", 2, 0), 2);
+	KUNIT_EXPECT_EQ(test, ctx->dev.size, 4UL);
+	KUNIT_EXPECT_EQ(test, atomic_long_read(&ctx->dev.tail), 4L);
+	KUNIT_EXPECT_EQ(test, scull_test_read(ctx, out, 4, 0), 4);
+	KUNIT_EXPECT_EQ(test, memcmp(out, "abcd", 4), 0);
+
+	/* a record that straddles two quanta is not split */
+	memset(buf, 'x', quantum);
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, buf, quantum, 0), (ssize_t)quantum);
+	KUNIT_EXPECT_EQ(test, ctx->dev.size, 4UL + quantum);
+
+	/* a failed append gives its reservation back */
+	ctx->dev.max_bytes = 2 * quantum;
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, buf, quantum, 0), -ENOSPC);
+	KUNIT_EXPECT_EQ(test, ctx->dev.size, 4UL + quantum);
+	KUNIT_EXPECT_EQ(test, atomic_long_read(&ctx->dev.tail), 4L + quantum);
+
+	/* and plain writes keep the tail at the end */
+	ctx->filp.f_flags = O_RDWR;
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "e", 1, 2 * quantum - 1), 1);
+	KUNIT_EXPECT_EQ(test, atomic_long_read(&ctx->dev.tail), 2L * quantum);
+}
+
+static void scull_notify_test(struct kunit *test)
+{
+	struct scull_test_ctx *ctx = test->priv;
+	char out[4];
+
+	/* the first write that grows the device signals, the next ones not */
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "ab", 2, 0), 2);
+	KUNIT_EXPECT_EQ(test, ctx->dev.notify.signalled, 1);
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "cd", 2, 2), 2);
+	KUNIT_EXPECT_EQ(test, ctx->dev.notify.bytes, (size_t)2);
+
+	/* a reader that is not at the end keeps them coalesced */
+	KUNIT_EXPECT_EQ(test, scull_test_read(ctx, out, 2, 0), 2);
+	KUNIT_EXPECT_EQ(test, ctx->dev.notify.signalled, 1);
+
+	/* one that reaches it re-arms the signal */
+	KUNIT_EXPECT_EQ(test, scull_test_read(ctx, out, 2, 2), 2);
+	KUNIT_EXPECT_EQ(test, ctx->dev.notify.signalled, 0);
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "ef", 2, 4), 2);
+	KUNIT_EXPECT_EQ(test, ctx->dev.notify.signalled, 1);
+	KUNIT_EXPECT_EQ(test, ctx->dev.notify.bytes, (size_t)0);
+}
+
+static void scull_snapshot_test(struct kunit *test)
+{
+	struct scull_test_ctx *ctx = test->priv;
+	loff_t itemsize = (loff_t)ctx->dev.quantum * ctx->dev.qset;
+	struct scull_qset *head, *tail;
+	struct scull_dev *snap;
+	struct file sfilp = { };
+	char *out = ctx->kbuf;
+	loff_t off;
+
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "head", 4, 0), 4);
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "tail", 4, itemsize), 4);
+	head = ctx->dev.data;
+	tail = head->next;
+
+	snap = kunit_kzalloc(test, sizeof(*snap), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, snap);
+	scull_dev_init(snap);
+	scull_clone(&ctx->dev, snap);
+	KUNIT_EXPECT_PTR_EQ(test, snap->data, head);
+	KUNIT_EXPECT_EQ(test, atomic_read(&head->ref), 2);
+	KUNIT_EXPECT_EQ(test, snap->size, ctx->dev.size);
+
+	/* a write to the second qset copies both qsets and one quantum */
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "T", 1, itemsize), 1);
+	KUNIT_EXPECT_PTR_NE(test, ctx->dev.data, head);
+	KUNIT_EXPECT_PTR_NE(test, ctx->dev.data->next, tail);
+	KUNIT_EXPECT_PTR_EQ(test, ctx->dev.data->data[0], head->data[0]);
+	KUNIT_EXPECT_PTR_NE(test, ctx->dev.data->next->data[0], tail->data[0]);
+	KUNIT_EXPECT_EQ(test, atomic_read(&head->ref), 1);
+
+	/* the snapshot still reads what was there when it was taken */
+	sfilp.private_data = snap;
+	off = itemsize;
+	KUNIT_EXPECT_EQ(test, scull_read(&sfilp, ctx->ubuf, 4, &off), 4);
+	KUNIT_EXPECT_EQ(test, copy_from_user(out, ctx->ubuf, 4), 0UL);
+	KUNIT_EXPECT_MEMEQ(test, out, "tail", 4);
+	KUNIT_EXPECT_EQ(test, scull_test_read(ctx, out, 4, itemsize), 4);
+	KUNIT_EXPECT_MEMEQ(test, out, "Tail", 4);
+
+	/* dropping it leaves the device's own chain intact */
+	scull_trim(snap);
+	KUNIT_EXPECT_EQ(test, scull_test_read(ctx, out, 4, 0), 4);
+	KUNIT_EXPECT_MEMEQ(test, out, "head", 4);
+}
+
+static void scull_append_snapshot_test(struct kunit *test)
+{
+	struct scull_test_ctx *ctx = test->priv;
+	int quantum = ctx->dev.quantum;
+	struct scull_qbuf *q0, *q1;
+	struct scull_dev *snap;
+	struct file sfilp = { };
+	char out[4];
+	loff_t off = 0;
+
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "ab", 2, 0), 2);
+	KUNIT_EXPECT_EQ(test, scull_reserve(&ctx->dev, quantum, quantum), 0);
+	q0 = ctx->dev.data->data[0];
+	q1 = ctx->dev.data->data[1];
+
+	snap = kunit_kzalloc(test, sizeof(*snap), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, snap);
+	scull_dev_init(snap);
+	scull_clone(&ctx->dev, snap);
+	KUNIT_EXPECT_EQ(test, ctx->dev.appendable, 0);
+
+	/*
+	 * The first append copies the chain and the quantum the end is in,
+	 * and gives the reserved quantum past the end back to the snapshot.
+	 */
+	ctx->filp.f_flags = O_WRONLY | O_APPEND;
+	KUNIT_EXPECT_EQ(test, scull_test_write(ctx, "cd", 2, 0), 2);
+	KUNIT_EXPECT_EQ(test, ctx->dev.appendable, 1);
+	KUNIT_EXPECT_PTR_NE(test, ctx->dev.data, snap->data);
+	KUNIT_EXPECT_PTR_NE(test, ctx->dev.data->data[0], q0);
+	KUNIT_EXPECT_NULL(test, ctx->dev.data->data[1]);
+	KUNIT_EXPECT_EQ(test, atomic_read(&q0->ref), 1);
+	KUNIT_EXPECT_EQ(test, atomic_read(&q1->ref), 1);
+	KUNIT_EXPECT_EQ(test, ctx->dev.bytes, (unsigned long)quantum);
+
+	KUNIT_EXPECT_EQ(test, scull_test_read(ctx, out, 4, 0), 4);
+	KUNIT_EXPECT_MEMEQ(test, out, "abcd", 4);
+	sfilp.private_data = snap;
+	KUNIT_EXPECT_EQ(test, snap->size, 2UL);
+	KUNIT_EXPECT_EQ(test, scull_read(&sfilp, ctx->ubuf, 4, &off), 2);
+	KUNIT_EXPECT_EQ(test, copy_from_user(out, ctx->ubuf, 2), 0UL);
+	KUNIT_EXPECT_MEMEQ(test, out, "ab", 2);
+	scull_trim(snap);
+}
+
+#define SCULL_TEST_RING	16
+
+static int scull_ring_test_init(struct kunit *test)
+{
+	struct scull_test_ctx *ctx;
+	struct scull_pipe *pipe;
+
+	scull_test_init(test);
+	ctx = test->priv;
+	pipe = kunit_kzalloc(test, sizeof(*pipe), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, pipe);
+	mutex_init(&pipe->mutex);
+	mutex_init(&pipe->rlock);
+	mutex_init(&pipe->wlock);
+	KUNIT_ASSERT_EQ(test, scull_p_ring_init(pipe, SCULL_TEST_RING), 0);
+	ctx->filp.private_data = pipe;
+	return 0;
+}
+
+static void scull_ring_test_exit(struct kunit *test)
+{
+	struct scull_test_ctx *ctx = test->priv;
+
+	scull_p_ring_free(ctx->filp.private_data);
+}
+
+static void scull_spacefree_test(struct kunit *test)
+{
+	struct scull_test_ctx *ctx = test->priv;
+	struct scull_pipe *pipe = ctx->filp.private_data;
+
+	/* empty ring: everything but the guard byte is free */
+	KUNIT_EXPECT_EQ(test, scull_p_spacefree(pipe), SCULL_TEST_RING - 1);
+
+	/* one byte queued */
+	pipe->wp = pipe->rp + 1;
+	KUNIT_EXPECT_EQ(test, scull_p_spacefree(pipe), SCULL_TEST_RING - 2);
+
+	/* full, both without and with the data wrapping */
+	pipe->rp = pipe->buffer;
+	pipe->wp = pipe->end - 1;
+	KUNIT_EXPECT_EQ(test, scull_p_spacefree(pipe), 0);
+	pipe->rp = pipe->buffer + 5;
+	pipe->wp = pipe->buffer + 4;
+	KUNIT_EXPECT_EQ(test, scull_p_spacefree(pipe), 0);
+
+	/* writer behind the reader after a wrap */
+	pipe->wp = pipe->buffer + 1;
+	KUNIT_EXPECT_EQ(test, scull_p_spacefree(pipe), 3);
+}
+
+static void scull_ring_wrap_test(struct kunit *test)
+{
+	struct scull_test_ctx *ctx = test->priv;
+	struct scull_pipe *pipe = ctx->filp.private_data;
+	char *out = ctx->kbuf;
+	ssize_t n;
+
+	KUNIT_ASSERT_EQ(test, copy_to_user(ctx->ubuf, "abcdefghijklmnopqrstuvwxyz", 26), 0UL);
+
+	/* move both pointers close to the end of the buffer */
+	KUNIT_EXPECT_EQ(test, scull_p_ring_write(pipe, ctx->ubuf, 12), 12);
+	KUNIT_EXPECT_EQ(test, scull_p_ring_read(pipe, ctx->ubuf + 32, 12), 12);
+	KUNIT_EXPECT_PTR_EQ(test, pipe->rp, pipe->wp);
+
+	/* a write stops at the end of the buffer and continues at the start */
+	n = scull_p_ring_write(pipe, ctx->ubuf, 10);
+	KUNIT_EXPECT_EQ(test, n, 4);
+	KUNIT_EXPECT_PTR_EQ(test, pipe->wp, pipe->buffer);
+	n = scull_p_ring_write(pipe, ctx->ubuf + 4, 6);
+	KUNIT_EXPECT_EQ(test, n, 6);
+	KUNIT_EXPECT_EQ(test, scull_p_spacefree(pipe), SCULL_TEST_RING - 1 - 10);
+
+	/* and reads follow the same two runs */
+	n = scull_p_ring_read(pipe, ctx->ubuf + 32, 10);
+	KUNIT_EXPECT_EQ(test, n, 4);
+	KUNIT_EXPECT_PTR_EQ(test, pipe->rp, pipe->buffer);
+	n = scull_p_ring_read(pipe, ctx->ubuf + 36, 10);
+	KUNIT_EXPECT_EQ(test, n, 6);
+	KUNIT_ASSERT_EQ(test, copy_from_user(out, ctx->ubuf + 32, 10), 0UL);
+	KUNIT_EXPECT_MEMEQ(test, out, "abcdefghij", 10);
+	KUNIT_EXPECT_PTR_EQ(test, pipe->rp, pipe->wp);
+}
+
+static void scull_ring_full_test(struct kunit *test)
+{
+	struct scull_test_ctx *ctx = test->priv;
+	struct scull_pipe *pipe = ctx->filp.private_data;
+
+	/* a full ring accepts nothing more */
+	KUNIT_EXPECT_EQ(test, scull_p_ring_write(pipe, ctx->ubuf, 100), SCULL_TEST_RING - 1);
+	KUNIT_EXPECT_EQ(test, scull_p_spacefree(pipe), 0);
+	KUNIT_EXPECT_EQ(test, scull_p_ring_write(pipe, ctx->ubuf, 1), 0);
+	KUNIT_EXPECT_EQ(test, scull_p_ring_read(pipe, ctx->ubuf, 100), SCULL_TEST_RING - 1);
+	KUNIT_EXPECT_EQ(test, scull_p_spacefree(pipe), SCULL_TEST_RING - 1);
+
+	/* and an empty one gives nothing */
+	KUNIT_EXPECT_TRUE(test, scull_p_empty(pipe));
+	KUNIT_EXPECT_EQ(test, scull_p_ring_read(pipe, ctx->ubuf, 1), 0);
+}
+
+#define SCULL_LINE(type, field)	(offsetof(type, field) / SMP_CACHE_BYTES)
+
+static void scull_pipe_layout_test(struct kunit *test)
+{
+	/* each side of a pipe writes its own lines only */
+	KUNIT_EXPECT_NE(test, SCULL_LINE(struct scull_pipe, rp), SCULL_LINE(struct scull_pipe, wp));
+	KUNIT_EXPECT_EQ(test, SCULL_LINE(struct scull_pipe, rp), SCULL_LINE(struct scull_pipe, wp_seen));
+	KUNIT_EXPECT_EQ(test, SCULL_LINE(struct scull_pipe, wp), SCULL_LINE(struct scull_pipe, rp_seen));
+	KUNIT_EXPECT_NE(test, SCULL_LINE(struct scull_pipe, rlock), SCULL_LINE(struct scull_pipe, wp));
+	KUNIT_EXPECT_NE(test, SCULL_LINE(struct scull_pipe, wlock), SCULL_LINE(struct scull_pipe, rp));
+	KUNIT_EXPECT_NE(test, SCULL_LINE(struct scull_pipe, buffer), SCULL_LINE(struct scull_pipe, rp));
+	KUNIT_EXPECT_NE(test, SCULL_LINE(struct scull_pipe, buffer), SCULL_LINE(struct scull_pipe, wp));
+	/* and whole lines, so that neighbouring pipes do not share one */
+	KUNIT_EXPECT_EQ(test, sizeof(struct scull_pipe) % SMP_CACHE_BYTES, 0UL);
+	KUNIT_EXPECT_EQ(test, sizeof(struct scull_dev) % SMP_CACHE_BYTES, 0UL);
+}
+
+#define SCULL_BENCH_BYTES	(16 << 20)
+
+static void scull_alloc_bench(struct kunit *test)
+{
+	struct scull_test_ctx *ctx = test->priv;
+	int quantum = ctx->dev.quantum;
+	loff_t off;
+	u64 t0, fill, rewrite, trim;
+	long ops = 0;
+
+	/* zero quanta would be settled and freed again right away */
+	memset(ctx->kbuf, 0x5a, quantum);
+	KUNIT_ASSERT_EQ(test, copy_to_user(ctx->ubuf, ctx->kbuf, quantum), 0UL);
+
+	t0 = ktime_get_ns();
+	/* scull_write advances off by one quantum per call */
+	for(off = 0; off + quantum <= SCULL_BENCH_BYTES; ops++)
+		KUNIT_ASSERT_EQ(test, scull_write(&ctx->filp, ctx->ubuf, quantum, &off), (ssize_t)quantum);
+	fill = ktime_get_ns() - t0;
+
+	t0 = ktime_get_ns();
+	for(off = 0; off + quantum <= SCULL_BENCH_BYTES; )
+		scull_write(&ctx->filp, ctx->ubuf, quantum, &off);
+	rewrite = ktime_get_ns() - t0;
+
+	t0 = ktime_get_ns();
+	scull_trim(&ctx->dev);
+	trim = ktime_get_ns() - t0;
+
+	kunit_info(test, "alloc path: %ld quanta, fill %llu ns/op, rewrite %llu ns/op, trim %llu ns\n",
+		   ops, fill / ops, rewrite / ops, trim);
+}
+
+static void scull_ring_bench(struct kunit *test)
+{
+	struct scull_test_ctx *ctx = test->priv;
+	struct scull_pipe *pipe;
+	static const int sizes[] = { 1, 64, 1024, 3999 };
+	const long rounds = 100000;
+	int i;
+
+	pipe = kunit_kzalloc(test, sizeof(*pipe), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, pipe);
+	mutex_init(&pipe->rlock);
+	mutex_init(&pipe->wlock);
+	KUNIT_ASSERT_EQ(test, scull_p_ring_init(pipe, 4000), 0);
+
+	for(i=0;i<ARRAY_SIZE(sizes);i++) {
+		u64 t0 = ktime_get_ns(), ns;
+		long r, bytes = 0;
+
+		/* each side under its own lock, like scull_p_write/scull_p_read */
+		for(r=0;r<rounds;r++) {
+			mutex_lock(&pipe->wlock);
+			bytes += scull_p_ring_write(pipe, ctx->ubuf, sizes[i]);
+			mutex_unlock(&pipe->wlock);
+			mutex_lock(&pipe->rlock);
+			while(scull_p_ring_read(pipe, ctx->ubuf, sizes[i]) > 0)
+				;
+			mutex_unlock(&pipe->rlock);
+		}
+		ns = ktime_get_ns() - t0;
+		kunit_info(test, "ring path: %d bytes, %llu ns/round, %llu MB/s\n",
+			   sizes[i], ns / rounds, ns ? bytes * 1000ULL / ns : 0);
+	}
+	scull_p_ring_free(pipe);
+}
+
+static struct kunit_case scull_qset_cases[] = {
+	KUNIT_CASE(scull_follow_test),
+	KUNIT_CASE(scull_partial_quantum_write_test),
+	KUNIT_CASE(scull_qset_boundary_test),
+	KUNIT_CASE(scull_trim_test),
+	KUNIT_CASE(scull_stats_test),
+	KUNIT_CASE(scull_zero_quantum_test),
+	KUNIT_CASE(scull_shared_quantum_cow_test),
+	KUNIT_CASE(scull_compress_test),
+	KUNIT_CASE(scull_dedup_test),
+	KUNIT_CASE(scull_snapshot_test),
+	KUNIT_CASE(scull_append_snapshot_test),
+	KUNIT_CASE(scull_numa_test),
+	KUNIT_CASE(scull_reserve_test),
+	KUNIT_CASE(scull_limit_test),
+	KUNIT_CASE(scull_notify_test),
+	KUNIT_CASE(scull_append_test),
+	KUNIT_CASE_SLOW(scull_alloc_bench),
+	{}
+};
+
+static struct kunit_suite scull_qset_suite = {
+	.name = "scull_qset",
+	.init = scull_test_init,
+	.exit = scull_test_exit,
+	.test_cases = scull_qset_cases,
+};
+
+static struct kunit_case scull_ring_cases[] = {
+	KUNIT_CASE(scull_spacefree_test),
+	KUNIT_CASE(scull_ring_wrap_test),
+	KUNIT_CASE(scull_ring_full_test),
+	KUNIT_CASE(scull_pipe_layout_test),
+	KUNIT_CASE_SLOW(scull_ring_bench),
+	{}
+};
+
+static struct kunit_suite scull_ring_suite = {
+	.name = "scull_ring",
+	.init = scull_ring_test_init,
+	.exit = scull_ring_test_exit,
+	.test_cases = scull_ring_cases,
+};
+
+kunit_test_suites(&scull_qset_suite, &scull_ring_suite);
@@ -0,0 +1,73 @@
+/*
+ * Read-only snapshots of the scull memory devices.
+ *
+ * SCULL_IOCSNAPSHOT hands back a new file descriptor on a private
+ * scull_dev that shares the whole qset chain of the device (see
+ * scull_clone() in qset.c).  Taking it holds dev->sem only for as long
+ * as it takes to bump one reference count; the device pays for the
+ * snapshot later, one qset and one quantum at a time, as it writes over
+ * shared memory.  Closing the last descriptor drops the snapshot.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/slab.h>
+#include <linux/cdev.h>
+#include <linux/semaphore.h>
+#include <linux/anon_inodes.h>
+
+#include "scull.h"
+
+static int scull_snap_release(struct inode *inode,struct file *filp) {
+	struct scull_dev *snap = filp->private_data;
+
+	scull_trim(snap);
+	kfree(snap);
+	return 0;
+}
+
+static const struct file_operations scull_snap_fops = {
+	.owner = THIS_MODULE,
+	.llseek = scull_llseek,
+	.read = scull_read,
+	.release = scull_snap_release,
+};
+
+int scull_snapshot(struct scull_dev *dev) {
+	struct scull_dev *snap;
+	struct file *file;
+	int fd;
+
+	snap = kzalloc(sizeof(struct scull_dev),GFP_KERNEL);
+	if(!snap)
+		return -ENOMEM;
+	scull_dev_init(snap);
+
+	fd = get_unused_fd_flags(O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		goto fail;
+	file = anon_inode_getfile("[scull-snapshot]",&scull_snap_fops,snap,O_RDONLY);
+	if(IS_ERR(file)) {
+		put_unused_fd(fd);
+		fd = PTR_ERR(file);
+		goto fail;
+	}
+	file->f_mode |= FMODE_PREAD;
+
+	if(down_write_killable(&dev->sem)) {
+		/* nothing shared yet: the release just frees snap */
+		fput(file);
+		put_unused_fd(fd);
+		return -ERESTARTSYS;
+	}
+	scull_clone(dev,snap);
+	up_write(&dev->sem);
+
+	fd_install(fd,file);
+	return fd;
+
+fail:
+	kfree(snap);
+	return fd;
+}
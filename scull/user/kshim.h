@@ -0,0 +1,379 @@
+#ifndef SCULL_KSHIM_H
+#define SCULL_KSHIM_H
+
+/*
+ * Just enough of the kernel API for qset.c and ring.c to build as a
+ * user-space library.  Allocation maps to malloc, rwsems to pthread
+ * rwlocks, mutexes to pthread mutexes and the user copy helpers to memcpy.  Wait queues,
+ * fasync and cdevs are placeholders; the code that uses them stays in the
+ * kernel-only files.
+ */
+
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <time.h>
+#include <limits.h>
+#include <sched.h>
+#include <fcntl.h>
+
+#define __user
+
+#define ERESTARTSYS	512
+
+#define KERN_ALERT	""
+#define KERN_NOTICE	""
+#define KERN_DEBUG	""
+#define printk(fmt, args...) fprintf(stderr, fmt, ##args)
+
+#define SMP_CACHE_BYTES	64
+#define ____cacheline_aligned_in_smp	__attribute__((__aligned__(SMP_CACHE_BYTES)))
+
+#define min(a,b) ((a) < (b) ? (a) : (b))
+#define max(a,b) ((a) > (b) ? (a) : (b))
+
+#ifndef container_of
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+#endif
+
+/* a coarse clock is enough: nothing ages quanta in user space */
+#define jiffies ((unsigned long)time(NULL))
+
+typedef unsigned int gfp_t;
+#define GFP_KERNEL	0u
+#define GFP_KERNEL_ACCOUNT	0u
+#define __GFP_ZERO	0x100u
+#define SLAB_ACCOUNT	0ul
+
+static inline void *kmalloc(size_t size, gfp_t flags)
+{
+	return malloc(size);
+}
+
+static inline void *kzalloc(size_t size, gfp_t flags)
+{
+	return calloc(1, size);
+}
+
+#define NUMA_NO_NODE	(-1)
+
+static inline void *kmalloc_node(size_t size, gfp_t flags, int node)
+{
+	return malloc(size);
+}
+
+static inline void kfree(const void *p)
+{
+	free((void *)p);
+}
+
+/* a cache is just its object size; the bulk calls loop */
+struct kmem_cache {
+	size_t size;
+};
+
+static inline struct kmem_cache *kmem_cache_create(const char *name, unsigned int size,
+						   unsigned int align, unsigned long flags,
+						   void (*ctor)(void *))
+{
+	struct kmem_cache *c = malloc(sizeof(*c));
+
+	if(c)
+		c->size = size;
+	return c;
+}
+
+static inline void kmem_cache_destroy(struct kmem_cache *c)
+{
+	free(c);
+}
+
+static inline void *kmem_cache_alloc_node(struct kmem_cache *c, gfp_t flags, int node)
+{
+	return (flags & __GFP_ZERO) ? calloc(1, c->size) : malloc(c->size);
+}
+
+static inline void kmem_cache_free(struct kmem_cache *c, void *p)
+{
+	free(p);
+}
+
+static inline void kmem_cache_free_bulk(struct kmem_cache *c, size_t n, void **p)
+{
+	while(n--)
+		free(p[n]);
+}
+
+static inline int kmem_cache_alloc_bulk(struct kmem_cache *c, gfp_t flags, size_t n, void **p)
+{
+	size_t i;
+
+	for(i=0;i<n;i++) {
+		p[i] = kmem_cache_alloc_node(c, flags, NUMA_NO_NODE);
+		if(!p[i]) {
+			kmem_cache_free_bulk(c, i, p);
+			return 0;
+		}
+	}
+	return n;
+}
+
+#define cond_resched()	sched_yield()
+
+static inline unsigned long copy_to_user(void __user *to, const void *from, unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+static inline unsigned long copy_from_user(void *to, const void __user *from, unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+/* user memory is always there */
+#define fault_in_readable(p, n)	((size_t)0)
+#define pagefault_disable()	do { } while(0)
+#define pagefault_enable()	do { } while(0)
+
+static inline unsigned long clear_user(void __user *to, unsigned long n)
+{
+	memset(to, 0, n);
+	return 0;
+}
+
+static inline void *memchr_inv(const void *p, int c, size_t n)
+{
+	const unsigned char *s = p;
+
+	for(; n; n--, s++)
+		if(*s != (unsigned char)c)
+			return (void *)s;
+	return NULL;
+}
+
+typedef uint32_t u32;
+
+#define smp_load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define smp_mb() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define READ_ONCE(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define WRITE_ONCE(x, v) __atomic_store_n(&(x), v, __ATOMIC_RELAXED)
+
+typedef struct { int counter; } atomic_t;
+
+static inline int atomic_read(const atomic_t *v)
+{
+	return __atomic_load_n(&v->counter, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_set(atomic_t *v, int i)
+{
+	__atomic_store_n(&v->counter, i, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_inc(atomic_t *v)
+{
+	__atomic_add_fetch(&v->counter, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline int atomic_dec_and_test(atomic_t *v)
+{
+	return __atomic_sub_fetch(&v->counter, 1, __ATOMIC_SEQ_CST) == 0;
+}
+
+typedef struct { long counter; } atomic_long_t;
+
+static inline long atomic_long_read(const atomic_long_t *v)
+{
+	return __atomic_load_n(&v->counter, __ATOMIC_RELAXED);
+}
+
+static inline void atomic_long_set(atomic_long_t *v, long i)
+{
+	__atomic_store_n(&v->counter, i, __ATOMIC_RELAXED);
+}
+
+static inline long atomic_long_cmpxchg(atomic_long_t *v, long old, long new)
+{
+	__atomic_compare_exchange_n(&v->counter, &old, new, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return old;
+}
+
+static inline long atomic_long_add_return(long i, atomic_long_t *v)
+{
+	return __atomic_add_fetch(&v->counter, i, __ATOMIC_SEQ_CST);
+}
+
+static inline void atomic_long_sub(long i, atomic_long_t *v)
+{
+	__atomic_sub_fetch(&v->counter, i, __ATOMIC_SEQ_CST);
+}
+
+#define MAX_ERRNO	4095
+#define IS_ERR_VALUE(x)	((unsigned long)(void *)(x) >= (unsigned long)-MAX_ERRNO)
+
+static inline void *ERR_PTR(long error)
+{
+	return (void *)error;
+}
+
+static inline long PTR_ERR(const void *ptr)
+{
+	return (long)ptr;
+}
+
+static inline int IS_ERR(const void *ptr)
+{
+	return IS_ERR_VALUE((unsigned long)ptr);
+}
+
+struct hlist_node {
+	struct hlist_node *next, **pprev;
+};
+
+static inline void INIT_HLIST_NODE(struct hlist_node *h)
+{
+	h->next = NULL;
+	h->pprev = NULL;
+}
+
+/* nobody is ever killed while waiting in user space */
+struct rw_semaphore {
+	pthread_rwlock_t lock;
+};
+
+/* like the kernel's, a waiting writer holds up new readers */
+static inline void init_rwsem(struct rw_semaphore *sem)
+{
+	pthread_rwlockattr_t attr;
+
+	pthread_rwlockattr_init(&attr);
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&sem->lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+}
+
+static inline void down_read(struct rw_semaphore *sem)
+{
+	pthread_rwlock_rdlock(&sem->lock);
+}
+
+static inline int down_read_killable(struct rw_semaphore *sem)
+{
+	pthread_rwlock_rdlock(&sem->lock);
+	return 0;
+}
+
+static inline void up_read(struct rw_semaphore *sem)
+{
+	pthread_rwlock_unlock(&sem->lock);
+}
+
+static inline void down_write(struct rw_semaphore *sem)
+{
+	pthread_rwlock_wrlock(&sem->lock);
+}
+
+static inline int down_write_killable(struct rw_semaphore *sem)
+{
+	pthread_rwlock_wrlock(&sem->lock);
+	return 0;
+}
+
+static inline int down_write_trylock(struct rw_semaphore *sem)
+{
+	return !pthread_rwlock_trywrlock(&sem->lock);
+}
+
+static inline void up_write(struct rw_semaphore *sem)
+{
+	pthread_rwlock_unlock(&sem->lock);
+}
+
+typedef struct {
+	pthread_mutex_t lock;
+} spinlock_t;
+
+#define DEFINE_SPINLOCK(x)	spinlock_t x = { PTHREAD_MUTEX_INITIALIZER }
+
+static inline void spin_lock(spinlock_t *l)
+{
+	pthread_mutex_lock(&l->lock);
+}
+
+static inline void spin_unlock(spinlock_t *l)
+{
+	pthread_mutex_unlock(&l->lock);
+}
+
+struct mutex {
+	pthread_mutex_t lock;
+};
+
+static inline void mutex_init(struct mutex *m)
+{
+	pthread_mutex_init(&m->lock, NULL);
+}
+
+static inline int mutex_lock_interruptible(struct mutex *m)
+{
+	pthread_mutex_lock(&m->lock);
+	return 0;
+}
+
+static inline void mutex_lock(struct mutex *m)
+{
+	pthread_mutex_lock(&m->lock);
+}
+
+static inline void mutex_unlock(struct mutex *m)
+{
+	pthread_mutex_unlock(&m->lock);
+}
+
+typedef struct { int unused; } wait_queue_head_t;
+struct fasync_struct;
+
+#define init_waitqueue_head(q)	do { } while(0)
+#define wake_up_interruptible(q)	do { } while(0)
+#define kill_fasync(fa, sig, band)	do { } while(0)
+/* nothing sleeps on a queue here: waiters spin */
+#define TASK_UNINTERRUPTIBLE	2
+#define TASK_NORMAL	3
+struct wait_queue_entry {
+	int (*func)(struct wait_queue_entry *wq, unsigned int mode, int sync, void *key);
+};
+#define init_wait_func(w, f)	((w)->func = (f))
+#define prepare_to_wait(q, w, state)	do { } while(0)
+#define finish_wait(q, w)	do { } while(0)
+#define schedule()	sched_yield()
+#define wq_has_sleeper(q)	0
+#define __wake_up(q, mode, nr, key)	do { } while(0)
+
+static inline int autoremove_wake_function(struct wait_queue_entry *wq, unsigned int mode, int sync, void *key)
+{
+	return 1;
+}
+struct cdev { int unused; };
+
+typedef unsigned int fmode_t;
+#define FMODE_READ	0x1
+#define FMODE_WRITE	0x2
+
+struct file {
+	void *private_data;
+	unsigned int f_flags;
+	fmode_t f_mode;
+};
+
+#endif
@@ -0,0 +1,215 @@
+/*
+ * qset_bench: microbenchmarks of the scull store in user space.
+ *
+ *   fill       first pass over an empty device (allocation path)
+ *   overwrite  second pass over the same range (no allocation)
+ *   read       sequential read of the range
+ *   follow     scull_follow() to the last qset of the range
+ *   trim       scull_trim() of the filled device
+ *   reserve    scull_reserve() of the whole range on an empty device
+ *   fill_reserved  first pass over the reserved range (no allocation)
+ *   append_locked  T threads writing size-byte records to their own parts
+ *                  of the device, one at a time under dev->sem
+ *   append     T threads appending size-byte records with O_APPEND,
+ *              copying in parallel (sizes up to a quantum)
+ *
+ *   qset_bench [-b 64m] [-s 512,4000,65536] [-t 1,4]
+ */
+#include <unistd.h>
+
+#include "ulib.h"
+#include "bench.h"
+
+#define MAX_SIZES 16
+
+static void report(const char *name, size_t size, uint64_t bytes, uint64_t ops, uint64_t ns)
+{
+	bench_begin(name);
+	bench_kv_u64("size", size);
+	bench_kv_u64("bytes", bytes);
+	bench_kv_u64("ops", ops);
+	bench_kv_u64("elapsed_ns", ns);
+	bench_kv_dbl("ns_per_op", ops ? (double)ns / ops : 0);
+	bench_kv_dbl("mb_s", ns ? bytes * 1000.0 / ns : 0);
+	bench_end();
+}
+
+static int pass(struct scull_dev *dev, char *buf, size_t size, size_t total, int write, uint64_t *ns)
+{
+	uint64_t t0 = bench_now_ns();
+	size_t off;
+
+	for(off = 0; off + size <= total; off += size) {
+		ssize_t n = write ? ulib_write_all(dev, buf, size, off) : ulib_read_all(dev, buf, size, off);
+		if(n != (ssize_t)size)
+			return -1;
+	}
+	*ns = bench_now_ns() - t0;
+	return 0;
+}
+
+struct appender {
+	pthread_t tid;
+	struct scull_dev *dev;
+	char *buf;
+	size_t size, n;
+	loff_t base;
+	int append, err;
+};
+
+static void *appender_fn(void *arg)
+{
+	struct appender *a = arg;
+	struct file filp;
+	loff_t pos = a->base;
+	size_t i;
+
+	ulib_file_init(&filp, a->dev);
+	filp.f_flags = O_APPEND;
+	for(i=0;i<a->n && !a->err;i++) {
+		if(a->append)
+			a->err = scull_write(&filp, a->buf, a->size, &pos) != (ssize_t)a->size;
+		else
+			a->err = ulib_write_all(a->dev, a->buf, a->size, pos) != (ssize_t)a->size;
+		pos += a->size;
+	}
+	return NULL;
+}
+
+static int run_append(size_t size, size_t total, int nthreads, int append)
+{
+	struct scull_dev dev;
+	struct appender *a = calloc(nthreads, sizeof(*a));
+	char *buf = malloc(size);
+	size_t n = total / size / nthreads;
+	uint64_t t0, ns;
+	int i, err = 0;
+
+	if(!a || !buf) {
+		free(a);
+		free(buf);
+		return -1;
+	}
+	memset(buf, 0x6b, size);
+	ulib_dev_init(&dev);
+
+	t0 = bench_now_ns();
+	for(i=0;i<nthreads;i++) {
+		a[i] = (struct appender){ .dev = &dev, .buf = buf, .size = size, .n = n,
+					  .base = (loff_t)i * n * size, .append = append };
+		pthread_create(&a[i].tid, NULL, appender_fn, &a[i]);
+	}
+	for(i=0;i<nthreads;i++) {
+		pthread_join(a[i].tid, NULL);
+		err |= a[i].err;
+	}
+	ns = bench_now_ns() - t0;
+
+	bench_begin(append ? "qset_append" : "qset_append_locked");
+	bench_kv_u64("size", size);
+	bench_kv_u64("threads", nthreads);
+	bench_kv_u64("bytes", n * size * nthreads);
+	bench_kv_dbl("ns_per_op", (double)ns / (n * nthreads));
+	bench_kv_dbl("mb_s", n * size * nthreads * 1000.0 / ns);
+	bench_end();
+
+	scull_trim(&dev);
+	free(buf);
+	free(a);
+	return err ? -1 : 0;
+}
+
+static int run(size_t size, size_t total)
+{
+	struct scull_dev dev;
+	char *buf = malloc(size);
+	uint64_t ns, ops = total / size, t0;
+	int i, reps = 100000, item;
+
+	if(!buf)
+		return -1;
+	memset(buf, 0x6b, size);
+	ulib_dev_init(&dev);
+
+	if(pass(&dev, buf, size, total, 1, &ns) < 0)
+		goto fail;
+	report("qset_fill", size, ops * size, ops, ns);
+	if(pass(&dev, buf, size, total, 1, &ns) < 0)
+		goto fail;
+	report("qset_overwrite", size, ops * size, ops, ns);
+	if(pass(&dev, buf, size, total, 0, &ns) < 0)
+		goto fail;
+	report("qset_read", size, ops * size, ops, ns);
+
+	item = (total - 1) / ((size_t)dev.quantum * dev.qset);
+	t0 = bench_now_ns();
+	for(i=0;i<reps;i++)
+		if(!scull_follow(&dev, item))
+			goto fail;
+	report("qset_follow", item, 0, reps, bench_now_ns() - t0);
+
+	t0 = bench_now_ns();
+	scull_trim(&dev);
+	report("qset_trim", size, total, 1, bench_now_ns() - t0);
+
+	t0 = bench_now_ns();
+	if(scull_reserve(&dev, 0, total))
+		goto fail;
+	report("qset_reserve", size, total, 1, bench_now_ns() - t0);
+	if(pass(&dev, buf, size, total, 1, &ns) < 0)
+		goto fail;
+	report("qset_fill_reserved", size, ops * size, ops, ns);
+	scull_trim(&dev);
+
+	free(buf);
+	return 0;
+fail:
+	fprintf(stderr, "qset_bench: size %zu failed\n", size);
+	scull_trim(&dev);
+	free(buf);
+	return -1;
+}
+
+int main(int argc, char **argv)
+{
+	size_t sizes[MAX_SIZES] = { 512, 4000, 65536 }, total = 64 << 20;
+	size_t threads[MAX_SIZES] = { 1, 4 };
+	int nsizes = 3, nthreads = 2, opt, s, t, ret = 0;
+
+	while((opt = getopt(argc, argv, "b:s:t:")) != -1) {
+		switch(opt) {
+		case 'b':
+			total = bench_parse_size(optarg);
+			break;
+		case 's':
+			nsizes = bench_parse_sizes(optarg, sizes, MAX_SIZES);
+			break;
+		case 't':
+			nthreads = bench_parse_sizes(optarg, threads, MAX_SIZES);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-b bytes] [-s sizes] [-t threads]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if(scull_qset_init())
+		return 1;
+	for(s=0;s<nsizes;s++)
+		if(sizes[s] && run(sizes[s], total) < 0)
+			ret = 1;
+	/* an append never covers more than a quantum */
+	for(s=0;s<nsizes;s++) {
+		if(!sizes[s] || sizes[s] > (size_t)scull_quantum)
+			continue;
+		for(t=0;t<nthreads;t++) {
+			if(!threads[t])
+				continue;
+			if(run_append(sizes[s], total, threads[t], 0) < 0 ||
+			   run_append(sizes[s], total, threads[t], 1) < 0)
+				ret = 1;
+		}
+	}
+	scull_qset_exit();
+	return ret;
+}
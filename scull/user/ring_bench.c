@@ -0,0 +1,132 @@
+/*
+ * ring_bench: microbenchmarks of the scullpipe ring in user space.
+ *
+ *   ring_cycle  one thread writes a chunk and reads it back, under the
+ *               side locks exactly like scull_p_write/scull_p_read
+ *   ring_spsc   one producer and one consumer thread streaming through
+ *               the ring, yielding when it is full or empty
+ *
+ *   ring_bench [-s 1,64,1024,3999] [-b 64m] [-r 4000]
+ */
+#include <sched.h>
+#include <unistd.h>
+
+#include "ulib.h"
+#include "bench.h"
+
+#define MAX_SIZES 16
+
+struct spsc {
+	struct scull_pipe *dev;
+	size_t size, total;
+};
+
+static size_t ring_xfer(struct scull_pipe *dev, char *buf, size_t size, int write)
+{
+	ssize_t n;
+
+	if(write) {
+		mutex_lock(&dev->wlock);
+		n = scull_p_ring_write(dev, buf, size);
+		mutex_unlock(&dev->wlock);
+	} else {
+		mutex_lock(&dev->rlock);
+		n = scull_p_ring_read(dev, buf, size);
+		mutex_unlock(&dev->rlock);
+	}
+	return n > 0 ? n : 0;
+}
+
+static void *producer_fn(void *arg)
+{
+	struct spsc *s = arg;
+	char *buf = malloc(s->size);
+	size_t done = 0;
+
+	memset(buf, 0x11, s->size);
+	while(done < s->total) {
+		size_t n = ring_xfer(s->dev, buf, min(s->size, s->total - done), 1);
+		if(!n)
+			sched_yield();
+		done += n;
+	}
+	free(buf);
+	return NULL;
+}
+
+static void run(size_t size, size_t total, int ringsize)
+{
+	struct scull_pipe dev;
+	struct spsc s = { &dev, size, total };
+	char *buf = malloc(size);
+	uint64_t t0, ns, ops = 0;
+	size_t done;
+	pthread_t tid;
+
+	ulib_pipe_init(&dev, ringsize);
+
+	t0 = bench_now_ns();
+	for(done = 0; done < total; ) {
+		size_t n = ring_xfer(&dev, buf, size, 1);
+		while(ring_xfer(&dev, buf, size, 0))
+			;
+		done += n;
+		ops++;
+	}
+	ns = bench_now_ns() - t0;
+	bench_begin("ring_cycle");
+	bench_kv_u64("size", size);
+	bench_kv_u64("ringsize", ringsize);
+	bench_kv_u64("bytes", done);
+	bench_kv_dbl("ns_per_op", (double)ns / ops);
+	bench_kv_dbl("mb_s", done * 1000.0 / ns);
+	bench_end();
+
+	t0 = bench_now_ns();
+	pthread_create(&tid, NULL, producer_fn, &s);
+	for(done = 0; done < total; ) {
+		size_t n = ring_xfer(&dev, buf, size, 0);
+		if(!n)
+			sched_yield();
+		done += n;
+	}
+	pthread_join(tid, NULL);
+	ns = bench_now_ns() - t0;
+	bench_begin("ring_spsc");
+	bench_kv_u64("size", size);
+	bench_kv_u64("ringsize", ringsize);
+	bench_kv_u64("bytes", done);
+	bench_kv_dbl("mb_s", done * 1000.0 / ns);
+	bench_end();
+
+	scull_p_ring_free(&dev);
+	free(buf);
+}
+
+int main(int argc, char **argv)
+{
+	size_t sizes[MAX_SIZES] = { 1, 64, 1024, 3999 }, total = 64 << 20;
+	int nsizes = 4, opt, s, ringsize = 4000;
+
+	while((opt = getopt(argc, argv, "s:b:r:")) != -1) {
+		switch(opt) {
+		case 's':
+			nsizes = bench_parse_sizes(optarg, sizes, MAX_SIZES);
+			break;
+		case 'b':
+			total = bench_parse_size(optarg);
+			break;
+		case 'r':
+			ringsize = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s sizes] [-b bytes] [-r ringsize]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	for(s=0;s<nsizes;s++)
+		if(sizes[s])
+			run(sizes[s], sizes[s] < 64 ? total / 64 : total, ringsize);
+	return 0;
+}
@@ -0,0 +1,588 @@
+/*
+ * stress: multithreaded consistency test of the scull store and ring.
+ *
+ * Store: writer threads each own a slice of one shared device and write
+ * random runs (and now and then a whole quantum of zeros) at random
+ * offsets, keeping a shadow copy they verify every read against; reader
+ * threads scan the whole device concurrently, and one more thread keeps
+ * reserving random ranges, which must not change what anybody reads.
+ *
+ * Snapshot: the same writers keep going in rounds; between rounds the
+ * device is cloned and the shadows frozen, and during the next round
+ * reader threads check the snapshot against that frozen copy while the
+ * writers copy their way out from under it.
+ *
+ * Append: writer threads append fixed-size records to one device with
+ * O_APPEND while readers follow the end and one more thread keeps taking
+ * and dropping snapshots of it.  Records straddle quanta, yet a reader
+ * must only ever find whole records, in the device and in a snapshot,
+ * and in the end every record must be there once, each writer's in the
+ * order it wrote them.
+ *
+ * Ring: producers push 8-byte records (producer id, sequence number)
+ * through one ring, consumers pop them.  Every consumer must see each
+ * producer's sequence numbers in increasing order, and the totals must
+ * match once the ring is drained.
+ *
+ *   stress [-w 4] [-r 2] [-p 3] [-c 3] [-n 20000]
+ *
+ * Exits non-zero on the first mismatch.
+ */
+#include <sched.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "ulib.h"
+
+#define SLICE	(3 * 4000 * 1000 / 2)	/* straddles qset boundaries */
+#define MAXRUN	20000
+#define MAXP	16
+
+static struct scull_dev sdev, snap;
+static char *frozen;
+static struct scull_pipe pdev;
+static long iters = 20000;
+static volatile int failed, writers_done, producers_done;
+
+struct store_worker {
+	pthread_t tid;
+	int id;
+	unsigned int seed;
+	char *shadow;
+	long iters;
+	int filled;
+};
+
+static void fail(const char *what, long a, long b)
+{
+	fprintf(stderr, "stress: %s (%ld, %ld)\n", what, a, b);
+	failed = 1;
+}
+
+/* The device's usage must match its quanta, and nothing may leak. */
+static void check_charges(struct scull_dev *dev)
+{
+	struct scull_stats st;
+
+	scull_stats(dev, &st, NULL);
+	if(dev->bytes != (st.quanta - st.zero) * dev->quantum)
+		fail("device bytes", dev->bytes, (st.quanta - st.zero) * dev->quantum);
+	if(scull_charged() != dev->bytes)
+		fail("charged bytes", scull_charged(), dev->bytes);
+}
+
+static void *store_writer(void *arg)
+{
+	struct store_worker *w = arg;
+	loff_t base = (loff_t)w->id * SLICE;
+	char *buf = malloc(MAXRUN);
+	long i;
+
+	/* lay the slice down once so every later read has data behind it */
+	if(!w->filled) {
+		memset(w->shadow, w->id, SLICE);
+		if(ulib_write_all(&sdev, w->shadow, SLICE, base) != SLICE)
+			fail("initial write", w->id, 0);
+		w->filled = 1;
+	}
+
+	for(i=0;i<w->iters && !failed;i++) {
+		size_t off = rand_r(&w->seed) % SLICE;
+		size_t len = 1 + rand_r(&w->seed) % MAXRUN;
+		ssize_t n;
+
+		if(rand_r(&w->seed) % 8 == 0) {
+			/* whole zero quanta take the zero-quantum path */
+			off -= (base + off) % scull_quantum;
+			len = scull_quantum;
+			if(off + len > SLICE)
+				continue;
+			memset(w->shadow + off, 0, len);
+			n = ulib_write_all(&sdev, w->shadow + off, len, base + off);
+			if(n != (ssize_t)len)
+				fail("zero write", off, n);
+			continue;
+		}
+		if(off + len > SLICE)
+			len = SLICE - off;
+		if(rand_r(&w->seed) & 1) {
+			memset(w->shadow + off, rand_r(&w->seed), len);
+			n = ulib_write_all(&sdev, w->shadow + off, len, base + off);
+			if(n != (ssize_t)len)
+				fail("write", off, n);
+		} else {
+			n = ulib_read_all(&sdev, buf, len, base + off);
+			if(n != (ssize_t)len || memcmp(buf, w->shadow + off, len))
+				fail("read back", off, n);
+		}
+	}
+	free(buf);
+	return NULL;
+}
+
+static void *store_reader(void *arg)
+{
+	struct store_worker *w = arg;
+	char *buf = malloc(MAXRUN);
+
+	while(!writers_done && !failed) {
+		loff_t off = rand_r(&w->seed) % sdev.size;
+		ssize_t n = ulib_read_all(&sdev, buf, MAXRUN, off);
+
+		if(n < 0)
+			fail("scan", off, n);
+	}
+	free(buf);
+	return NULL;
+}
+
+static void *store_reserver(void *arg)
+{
+	struct store_worker *w = arg;
+	size_t span = (size_t)w->id * SLICE;
+
+	while(!writers_done && !failed) {
+		loff_t off = rand_r(&w->seed) % span;
+		loff_t len = 1 + rand_r(&w->seed) % (64 * 4000);
+		int err = scull_reserve(&sdev, off, len);
+
+		if(err)
+			fail("reserve", off, err);
+	}
+	return NULL;
+}
+
+static int stress_store(int nwriters, int nreaders)
+{
+	struct store_worker *w = calloc(nwriters + nreaders + 1, sizeof(*w));
+	int i;
+
+	ulib_dev_init(&sdev);
+	writers_done = 0;
+	for(i=0;i<nwriters;i++) {
+		w[i].id = i;
+		w[i].seed = 42 + i;
+		w[i].shadow = malloc(SLICE);
+		w[i].iters = iters;
+		pthread_create(&w[i].tid, NULL, store_writer, &w[i]);
+	}
+	/* readers need a non-empty device for their random offsets */
+	while(!sdev.size)
+		sched_yield();
+	for(i=nwriters;i<nwriters+nreaders;i++) {
+		w[i].seed = 4242 + i;
+		pthread_create(&w[i].tid, NULL, store_reader, &w[i]);
+	}
+	/* reserve a little past the end too, where nothing is ever written */
+	w[i].id = nwriters + 1;
+	w[i].seed = 99;
+	pthread_create(&w[i].tid, NULL, store_reserver, &w[i]);
+	for(i=0;i<nwriters;i++)
+		pthread_join(w[i].tid, NULL);
+	writers_done = 1;
+	for(i=nwriters;i<nwriters+nreaders+1;i++)
+		pthread_join(w[i].tid, NULL);
+
+	if(!failed && sdev.size != (unsigned long)nwriters * SLICE)
+		fail("final size", sdev.size, (long)nwriters * SLICE);
+	if(!failed)
+		check_charges(&sdev);
+
+	for(i=0;i<nwriters;i++)
+		free(w[i].shadow);
+	free(w);
+	scull_trim(&sdev);
+	return failed;
+}
+
+static void *snap_reader(void *arg)
+{
+	struct store_worker *w = arg;
+	char *buf = malloc(MAXRUN);
+
+	while(!writers_done && !failed) {
+		loff_t off = rand_r(&w->seed) % snap.size;
+		size_t len = min((size_t)MAXRUN, snap.size - off);
+		ssize_t n = ulib_read_all(&snap, buf, len, off);
+
+		if(n != (ssize_t)len || memcmp(buf, frozen + off, len))
+			fail("snapshot read", off, n);
+	}
+	free(buf);
+	return NULL;
+}
+
+/* Clone sdev into snap and freeze the writers' shadows to match. */
+static void take_snapshot(struct store_worker *w, int nwriters)
+{
+	int i;
+
+	scull_trim(&snap);
+	down_write(&sdev.sem);
+	scull_clone(&sdev, &snap);
+	up_write(&sdev.sem);
+	for(i=0;i<nwriters;i++)
+		memcpy(frozen + (size_t)i * SLICE, w[i].shadow, SLICE);
+}
+
+static int stress_snapshot(int nwriters, int nreaders, int rounds)
+{
+	struct store_worker *w = calloc(nwriters + nreaders, sizeof(*w));
+	size_t total = (size_t)nwriters * SLICE;
+	char *buf = malloc(total);
+	int i, r;
+
+	ulib_dev_init(&sdev);
+	ulib_dev_init(&snap);
+	frozen = malloc(total);
+	for(i=0;i<nwriters;i++) {
+		w[i].id = i;
+		w[i].seed = 4711 + i;
+		w[i].shadow = malloc(SLICE);
+		w[i].iters = 0;
+		store_writer(&w[i]);
+	}
+	for(r=0;r<rounds && !failed;r++) {
+		take_snapshot(w, nwriters);
+		writers_done = 0;
+		for(i=0;i<nwriters;i++) {
+			w[i].iters = iters / rounds;
+			pthread_create(&w[i].tid, NULL, store_writer, &w[i]);
+		}
+		for(i=nwriters;i<nwriters+nreaders;i++) {
+			w[i].seed = 815 + r * nreaders + i;
+			pthread_create(&w[i].tid, NULL, snap_reader, &w[i]);
+		}
+		for(i=0;i<nwriters;i++)
+			pthread_join(w[i].tid, NULL);
+		writers_done = 1;
+		for(i=nwriters;i<nwriters+nreaders;i++)
+			pthread_join(w[i].tid, NULL);
+
+		/* the snapshot must have survived the whole round untouched */
+		if(!failed && (ulib_read_all(&snap, buf, total, 0) != (ssize_t)total ||
+			       memcmp(buf, frozen, total)))
+			fail("snapshot after round", r, 0);
+	}
+
+	scull_trim(&snap);
+	if(!failed)
+		check_charges(&sdev);
+	if(!failed) {
+		for(i=0;i<nwriters;i++)
+			memcpy(frozen + (size_t)i * SLICE, w[i].shadow, SLICE);
+		if(ulib_read_all(&sdev, buf, total, 0) != (ssize_t)total || memcmp(buf, frozen, total))
+			fail("device after snapshots", 0, 0);
+	}
+
+	for(i=0;i<nwriters;i++)
+		free(w[i].shadow);
+	free(w);
+	free(buf);
+	free(frozen);
+	scull_trim(&sdev);
+	return failed;
+}
+
+/* 48 bytes, so records straddle the 4000-byte quanta */
+struct app_rec {
+	uint32_t id, seq;
+	uint64_t check;
+	char fill[32];
+};
+
+static uint64_t app_check(uint32_t id, uint32_t seq)
+{
+	return ((uint64_t)id << 32 | seq) * 0x9e3779b97f4a7c15ull;
+}
+
+static void app_fill(struct app_rec *r, uint32_t id, uint32_t seq)
+{
+	r->id = id;
+	r->seq = seq;
+	r->check = app_check(id, seq);
+	memset(r->fill, (int)r->check, sizeof(r->fill));
+}
+
+static int app_valid(const struct app_rec *r)
+{
+	return r->check == app_check(r->id, r->seq) &&
+	       !memchr_inv(r->fill, (unsigned char)r->check, sizeof(r->fill));
+}
+
+static void *app_writer(void *arg)
+{
+	struct store_worker *w = arg;
+	struct app_rec r;
+	struct file filp;
+	loff_t pos = 0;
+	long i;
+
+	ulib_file_init(&filp, &sdev);
+	filp.f_flags = O_WRONLY | O_APPEND;
+	for(i=0;i<w->iters && !failed;i++) {
+		ssize_t n;
+
+		app_fill(&r, w->id, i);
+		n = scull_write(&filp, (const char *)&r, sizeof(r), &pos);
+		if(n != sizeof(r))
+			fail("append", i, n);
+	}
+	return NULL;
+}
+
+static void *app_reader(void *arg)
+{
+	struct app_rec r;
+	loff_t pos = 0;
+
+	for(;;) {
+		int done = writers_done;
+		ssize_t n = ulib_read_all(&sdev, (char *)&r, sizeof(r), pos);
+
+		if(n == 0 && done)
+			break;
+		if(n == 0) {
+			sched_yield();
+			continue;
+		}
+		/* commits are whole records, so a partial one was not committed */
+		if(n != sizeof(r) || !app_valid(&r)) {
+			fail("uncommitted record", pos, n);
+			break;
+		}
+		pos += n;
+	}
+	return NULL;
+}
+
+/* Clone the device under the appenders over and over, and drop the clone. */
+static void *app_snapshotter(void *arg)
+{
+	struct app_rec r;
+
+	while(!writers_done && !failed) {
+		down_write(&sdev.sem);
+		scull_clone(&sdev, &snap);
+		up_write(&sdev.sem);
+		if(snap.size % sizeof(r))
+			fail("snapshot size", snap.size, 0);
+		else if(snap.size && (ulib_read_all(&snap, (char *)&r, sizeof(r), snap.size - sizeof(r)) != sizeof(r) ||
+				      !app_valid(&r)))
+			fail("snapshot record", snap.size, 0);
+		scull_trim(&snap);
+		sched_yield();
+	}
+	return NULL;
+}
+
+static int stress_append(int nwriters, int nreaders)
+{
+	struct store_worker *w = calloc(nwriters + nreaders, sizeof(*w));
+	long *next = calloc(nwriters, sizeof(*next));
+	struct app_rec r;
+	pthread_t snapper;
+	loff_t pos;
+	int i;
+
+	ulib_dev_init(&sdev);
+	ulib_dev_init(&snap);
+	/* a long chain, for the snapshots to share and the readers to walk */
+	sdev.qset = 4;
+	writers_done = 0;
+	for(i=0;i<nwriters;i++) {
+		w[i].id = i;
+		w[i].iters = iters;
+		pthread_create(&w[i].tid, NULL, app_writer, &w[i]);
+	}
+	for(i=nwriters;i<nwriters+nreaders;i++)
+		pthread_create(&w[i].tid, NULL, app_reader, &w[i]);
+	pthread_create(&snapper, NULL, app_snapshotter, NULL);
+	for(i=0;i<nwriters;i++)
+		pthread_join(w[i].tid, NULL);
+	writers_done = 1;
+	for(i=nwriters;i<nwriters+nreaders;i++)
+		pthread_join(w[i].tid, NULL);
+	pthread_join(snapper, NULL);
+
+	if(!failed && sdev.size != (unsigned long)nwriters * iters * sizeof(r))
+		fail("final size", sdev.size, (long)nwriters * iters * sizeof(r));
+	if(!failed && atomic_long_read(&sdev.tail) != (long)sdev.size)
+		fail("tail", atomic_long_read(&sdev.tail), sdev.size);
+	for(pos=0;!failed && pos<(loff_t)sdev.size;pos+=sizeof(r)) {
+		if(ulib_read_all(&sdev, (char *)&r, sizeof(r), pos) != sizeof(r) || !app_valid(&r))
+			fail("record", pos, 0);
+		else if(r.id >= (uint32_t)nwriters || r.seq != next[r.id]++)
+			fail("record order", r.id, r.seq);
+	}
+	if(!failed)
+		check_charges(&sdev);
+
+	free(next);
+	free(w);
+	scull_trim(&sdev);
+	return failed;
+}
+
+struct ring_worker {
+	pthread_t tid;
+	int id;
+	uint64_t count, sum;
+	uint32_t last[MAXP];
+};
+
+/*
+ * Move one whole record under a single hold of this side's lock,
+ * wrapping if needed.  Only this side shrinks what it checked for, so
+ * the record fits for as long as it holds the lock.
+ */
+static int ring_xfer_record(uint64_t *rec, int write)
+{
+	struct mutex *lock = write ? &pdev.wlock : &pdev.rlock;
+	char *p = (char *)rec;
+	size_t done = 0;
+	int space;
+
+	mutex_lock(lock);
+	space = scull_p_spacefree(&pdev);
+	if(write ? space < (int)sizeof(*rec) : pdev.buffersize - 1 - space < (int)sizeof(*rec)) {
+		mutex_unlock(lock);
+		return 0;
+	}
+	while(done < sizeof(*rec)) {
+		ssize_t n = write ? scull_p_ring_write(&pdev, p + done, sizeof(*rec) - done)
+				  : scull_p_ring_read(&pdev, p + done, sizeof(*rec) - done);
+		if(n <= 0) {
+			mutex_unlock(lock);
+			fail("ring transfer", write, n);
+			return 0;
+		}
+		done += n;
+	}
+	mutex_unlock(lock);
+	return 1;
+}
+
+static void *producer(void *arg)
+{
+	struct ring_worker *w = arg;
+	uint32_t seq;
+
+	for(seq = 1; seq <= iters && !failed; ) {
+		uint64_t rec = ((uint64_t)w->id << 32) | seq;
+
+		if(!ring_xfer_record(&rec, 1)) {
+			sched_yield();
+			continue;
+		}
+		w->count++;
+		w->sum += seq;
+		seq++;
+	}
+	return NULL;
+}
+
+static void *consumer(void *arg)
+{
+	struct ring_worker *w = arg;
+	uint64_t rec;
+
+	while(!failed) {
+		uint32_t id, seq;
+
+		if(!ring_xfer_record(&rec, 0)) {
+			if(producers_done && scull_p_empty(&pdev))
+				break;
+			sched_yield();
+			continue;
+		}
+		id = rec >> 32;
+		seq = (uint32_t)rec;
+		if(id >= MAXP || seq <= w->last[id]) {
+			fail("ring order", id, seq);
+			break;
+		}
+		w->last[id] = seq;
+		w->count++;
+		w->sum += seq;
+	}
+	return NULL;
+}
+
+static int stress_ring(int nprod, int ncons)
+{
+	struct ring_worker *p = calloc(nprod, sizeof(*p)), *c = calloc(ncons, sizeof(*c));
+	uint64_t pc = 0, ps = 0, cc = 0, cs = 0;
+	int i;
+
+	ulib_pipe_init(&pdev, 4000);
+	producers_done = 0;
+	for(i=0;i<ncons;i++)
+		pthread_create(&c[i].tid, NULL, consumer, &c[i]);
+	for(i=0;i<nprod;i++) {
+		p[i].id = i;
+		pthread_create(&p[i].tid, NULL, producer, &p[i]);
+	}
+	for(i=0;i<nprod;i++) {
+		pthread_join(p[i].tid, NULL);
+		pc += p[i].count;
+		ps += p[i].sum;
+	}
+	producers_done = 1;
+	for(i=0;i<ncons;i++) {
+		pthread_join(c[i].tid, NULL);
+		cc += c[i].count;
+		cs += c[i].sum;
+	}
+
+	if(!failed && (pc != cc || ps != cs))
+		fail("ring totals", pc - cc, ps - cs);
+
+	scull_p_ring_free(&pdev);
+	free(p);
+	free(c);
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	int nwriters = 4, nreaders = 2, nprod = 3, ncons = 3, opt;
+
+	while((opt = getopt(argc, argv, "w:r:p:c:n:")) != -1) {
+		switch(opt) {
+		case 'w': nwriters = atoi(optarg); break;
+		case 'r': nreaders = atoi(optarg); break;
+		case 'p': nprod = atoi(optarg); break;
+		case 'c': ncons = atoi(optarg); break;
+		case 'n': iters = atol(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-w writers] [-r readers] [-p producers] [-c consumers] [-n iters]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(nwriters < 1)
+		nwriters = 1;
+	if(nprod > MAXP)
+		nprod = MAXP;
+
+	if(scull_qset_init())
+		return 1;
+	if(stress_store(nwriters, nreaders))
+		return 1;
+	if(scull_charged())
+		fail("charged after trim", scull_charged(), 0);
+	printf("store: %d writers, %d readers, %ld iterations: ok\n", nwriters, nreaders, iters);
+	if(stress_snapshot(nwriters, nreaders, 8))
+		return 1;
+	printf("snapshot: %d writers, %d readers, 8 rounds: ok\n", nwriters, nreaders);
+	if(stress_append(nwriters, nreaders))
+		return 1;
+	if(scull_charged())
+		fail("charged after trim", scull_charged(), 0);
+	printf("append: %d writers, %d readers, %ld records each: ok\n", nwriters, nreaders, iters);
+	if(stress_ring(nprod, ncons))
+		return 1;
+	printf("ring: %d producers, %d consumers, %ld records each: ok\n", nprod, ncons, iters);
+	scull_qset_exit();
+	return 0;
+}
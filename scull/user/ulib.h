@@ -0,0 +1,65 @@
+#ifndef SCULL_ULIB_H
+#define SCULL_ULIB_H
+
+#include "kshim.h"
+#include "scull.h"
+
+/* Set up a scull_dev/scull_pipe the way scull_init and scull_p_open do. */
+static inline void ulib_dev_init(struct scull_dev *dev)
+{
+	memset(dev, 0, sizeof(*dev));
+	dev->quantum = scull_quantum;
+	dev->qset = scull_qset;
+	scull_dev_init(dev);
+}
+
+static inline int ulib_pipe_init(struct scull_pipe *dev, int size)
+{
+	memset(dev, 0, sizeof(*dev));
+	mutex_init(&dev->mutex);
+	mutex_init(&dev->rlock);
+	mutex_init(&dev->wlock);
+	return scull_p_ring_init(dev, size);
+}
+
+static inline void ulib_file_init(struct file *filp, void *dev)
+{
+	memset(filp, 0, sizeof(*filp));
+	filp->private_data = dev;
+	filp->f_mode = FMODE_READ | FMODE_WRITE;
+}
+
+/* Loop over the one-quantum-at-a-time short counts of scull_read/write. */
+static inline ssize_t ulib_write_all(struct scull_dev *dev, const char *buf, size_t count, loff_t off)
+{
+	struct file filp;
+	size_t done = 0;
+
+	ulib_file_init(&filp, dev);
+	while(done < count) {
+		ssize_t n = scull_write(&filp, buf + done, count - done, &off);
+		if(n <= 0)
+			return n ? n : -EIO;
+		done += n;
+	}
+	return done;
+}
+
+static inline ssize_t ulib_read_all(struct scull_dev *dev, char *buf, size_t count, loff_t off)
+{
+	struct file filp;
+	size_t done = 0;
+
+	ulib_file_init(&filp, dev);
+	while(done < count) {
+		ssize_t n = scull_read(&filp, buf + done, count - done, &off);
+		if(n < 0)
+			return n;
+		if(n == 0)
+			break;
+		done += n;
+	}
+	return done;
+}
+
+#endif